@@ -8,10 +8,21 @@ in vec3 Color;
 // Output color
 out vec4 FragColor;
 
-// Lighting uniforms
-uniform vec3 lightPos;
-uniform vec3 lightColor;
-uniform vec3 viewPos;
+// Per-frame data shared by every stage; std140 mirror of FrameUniforms in utilities.h
+layout (std140, binding = 0) uniform FrameData {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    vec3 lightColor;
+    vec3 viewPos;
+    float gridSize;
+    int gridResolution;
+    float isoLevel;
+    int numSpheres;
+    float supportScale;
+    vec3 gridOrigin;
+};
 
 void main()
 {
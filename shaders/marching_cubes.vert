@@ -1,19 +1,45 @@
 #version 430 core
 
-layout (location = 0) in vec3 aPos;
+// Per-frame data shared by every stage; std140 mirror of FrameUniforms in utilities.h
+layout (std140, binding = 0) uniform FrameData {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    vec3 lightColor;
+    vec3 viewPos;
+    float gridSize;
+    int gridResolution;
+    float isoLevel;
+    int numSpheres;
+    float supportScale;
+    vec3 gridOrigin;
+};
 
-// Uniform matrices for transformations
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Bricks of brickCells^3 cells that some sphere reaches (MarchingCubes::BrickSphereLists::activeBricks,
+// or the influence bounds for the InverseSquare kernel) and that lie in the view frustum; instance i walks
+// the cells of brick i
+layout (std430, binding = 10) readonly buffer ActiveBricks {
+    int activeBrickCells;
+    ivec4 activeBrickOrigins[];
+};
 
 // Pass world position to geometry shader
 out vec3 worldPos;
 
 void main()
 {
+    // Cell origin of point gl_VertexID inside the brick, x slowest and z fastest as in MarchingCubes::generateGridPoints.
+    // Cells of partial bricks past gridResolution are dropped by the geometry shader.
+    int x = gl_VertexID / (activeBrickCells * activeBrickCells);
+    int y = (gl_VertexID / activeBrickCells) % activeBrickCells;
+    int z = gl_VertexID % activeBrickCells;
+    ivec3 cell = activeBrickOrigins[gl_InstanceID].xyz + ivec3(x, y, z);
+    float cellSize = gridSize / float(gridResolution);
+    vec3 gridPoint = gridOrigin + vec3(cell) * cellSize;
+    
     // Transform vertex position to world space
-    vec4 worldPosition = model * vec4(aPos, 1.0);
+    vec4 worldPosition = model * vec4(gridPoint, 1.0);
     worldPos = worldPosition.xyz;
     
     // Pass to geometry shader (no transformation here, geometry shader will handle it)
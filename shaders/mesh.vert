@@ -0,0 +1,41 @@
+#version 430 core
+
+// Vertices of a CPU-extracted mesh (MeshBuffer)
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+// Per-frame data shared by every stage; std140 mirror of FrameUniforms in utilities.h
+layout (std140, binding = 0) uniform FrameData {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    vec3 lightColor;
+    vec3 viewPos;
+    float gridSize;
+    int gridResolution;
+    float isoLevel;
+    int numSpheres;
+    float supportScale;
+    vec3 gridOrigin;
+};
+
+// Set while replaying a FeedbackMesh: the geometry shader recorded FragPos and Normal after applying
+// model, so they must not go through it a second time
+uniform bool worldSpaceInput = false;
+
+// Same outputs as the geometry shader, so marching_cubes.frag shades both paths
+out vec3 FragPos;
+out vec3 Normal;
+out vec3 Color;
+
+void main()
+{
+    mat4 toWorld = worldSpaceInput ? mat4(1.0) : model;
+    vec4 worldPosition = toWorld * vec4(aPos, 1.0);
+    FragPos = worldPosition.xyz;
+    Normal = mat3(toWorld) * aNormal;
+    Color = vec3(0.3, 0.7, 1.0); // Light blue color
+    
+    gl_Position = projection * view * worldPosition;
+}
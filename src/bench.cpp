@@ -0,0 +1,354 @@
+// Headless benchmark for the field and meshing kernels (no window, no GL context).
+// Prints one CSV row per (benchmark, sphere count, resolution):
+//   metaball_bench [--spheres 6,64,512] [--resolutions 20,64,128] [--repeats 10] [--warmup 2]
+//                  [--threads 0] [--out results.csv]
+// metaball_bench --check compares the analytic gradient with the finite-difference one instead and
+// exits non-zero when they disagree.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include "utilities.h"
+
+namespace {
+    const float GRID_SIZE = 8.0f;
+    const float ISO_LEVEL = 1.0f;
+    // Gradients are timed on every n-th grid point; the finite-difference one costs six field sums
+    const int GRADIENT_STRIDE = 7;
+    // --check: points per case, and the largest angle allowed between the two gradients
+    const int CHECK_POINTS = 2000;
+    const float CHECK_EPSILON = 1e-3f;
+    const float CHECK_MAX_DEGREES = 1.0f;
+    
+    struct Options {
+        std::vector<int> sphereCounts = { 6, 64, 512 };
+        std::vector<int> resolutions = { 20, 64, 128 };
+        int repeats = 10;
+        int warmup = 2;
+        unsigned int threadCount = 0;
+        std::string outPath;
+        bool check = false;
+    };
+    
+    struct Timing {
+        double meanMs, stddevMs, minMs, medianMs;
+    };
+    
+    // Keeps results observable so the timed loops are not optimised away
+    volatile float sink = 0.0f;
+    
+    std::vector<int> parseList(const std::string& text)
+    {
+        std::vector<int> values;
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ','))
+            values.push_back(std::stoi(item));
+        return values;
+    }
+    
+    bool parseOptions(int argc, char* argv[], Options& options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--check")
+            {
+                options.check = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << arg << std::endl;
+                return false;
+            }
+            std::string value = argv[++i];
+            if (arg == "--spheres")
+                options.sphereCounts = parseList(value);
+            else if (arg == "--resolutions")
+                options.resolutions = parseList(value);
+            else if (arg == "--repeats")
+                options.repeats = std::max(1, std::stoi(value));
+            else if (arg == "--warmup")
+                options.warmup = std::max(0, std::stoi(value));
+            else if (arg == "--threads")
+                options.threadCount = static_cast<unsigned int>(std::stoi(value));
+            else if (arg == "--out")
+                options.outPath = value;
+            else
+            {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    Timing measure(const Options& options, const std::function<void()>& run)
+    {
+        for (int i = 0; i < options.warmup; i++)
+            run();
+        
+        std::vector<double> samples(options.repeats);
+        for (int i = 0; i < options.repeats; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            samples[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        
+        double mean = 0.0;
+        for (double s : samples)
+            mean += s;
+        mean /= samples.size();
+        double variance = 0.0;
+        for (double s : samples)
+            variance += (s - mean) * (s - mean);
+        variance /= std::max<size_t>(samples.size() - 1, 1);
+        
+        std::sort(samples.begin(), samples.end());
+        return { mean, std::sqrt(variance), samples.front(), samples[samples.size() / 2] };
+    }
+    
+    // Same layout as the demo scene: spheres spread over the central 80% of the grid, radii shrinking
+    // with the count so the surface stays comparable
+    std::vector<Sphere> makeSpheres(int count)
+    {
+        std::mt19937 rng(1234);
+        float extent = GRID_SIZE * 0.4f;
+        std::uniform_real_distribution<float> position(-extent, extent);
+        float baseRadius = 1.0f / std::cbrt(static_cast<float>(count) / 6.0f);
+        std::uniform_real_distribution<float> radius(0.7f * baseRadius, 1.2f * baseRadius);
+        
+        std::vector<Sphere> spheres;
+        for (int i = 0; i < count; i++)
+            spheres.push_back(Sphere(glm::vec3(position(rng), position(rng), position(rng)), radius(rng), glm::vec3(0.0f)));
+        return spheres;
+    }
+    
+    // CPU copy of what marching_cubes.geom does for one grid point: its own 8 corner samples, triangles
+    // straight from the tables, a finite-difference normal per vertex, nothing shared between cells
+    size_t referencePolygonise(const std::vector<glm::vec3>& gridPoints, const std::vector<Sphere>& spheres, float cellSize)
+    {
+        static const glm::vec3 corners[8] = {
+            {0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+            {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+        };
+        static const int edges[12][2] = {
+            {0, 1}, {1, 2}, {2, 3}, {3, 0},
+            {4, 5}, {5, 6}, {6, 7}, {7, 4},
+            {0, 4}, {1, 5}, {2, 6}, {3, 7}
+        };
+        
+        size_t triangles = 0;
+        for (const glm::vec3& point : gridPoints)
+        {
+            glm::vec3 positions[8];
+            float values[8];
+            int cubeIndex = 0;
+            for (int c = 0; c < 8; c++)
+            {
+                positions[c] = point + corners[c] * cellSize;
+                values[c] = MarchingCubes::calculateScalarField(positions[c], spheres);
+                if (values[c] < ISO_LEVEL)
+                    cubeIndex |= (1 << c);
+            }
+            
+            int edgeMask = MarchingCubes::edgeTable[cubeIndex];
+            if (edgeMask == 0)
+                continue;
+            
+            glm::vec3 edgePoints[12];
+            for (int e = 0; e < 12; e++)
+            {
+                if ((edgeMask & (1 << e)) == 0)
+                    continue;
+                int a = edges[e][0];
+                int b = edges[e][1];
+                float mu = std::abs(values[b] - values[a]) > 0.00001f ? (ISO_LEVEL - values[a]) / (values[b] - values[a]) : 0.0f;
+                edgePoints[e] = positions[a] + mu * (positions[b] - positions[a]);
+            }
+            
+            for (int t = 0; MarchingCubes::triTable[cubeIndex][t] != -1; t += 3)
+            {
+                for (int v = 0; v < 3; v++)
+                    sink = sink + MarchingCubes::calculateGradient(edgePoints[MarchingCubes::triTable[cubeIndex][t + v]], spheres).x;
+                triangles++;
+            }
+        }
+        return triangles;
+    }
+    
+    // calculateAnalyticGradient against calculateGradient for both kernels, with and without a hash grid,
+    // at random points where the field is between 0.25 and 4 (around the surface, away from the centres)
+    bool checkGradients()
+    {
+        bool passed = true;
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> coordinate(-GRID_SIZE * 0.5f, GRID_SIZE * 0.5f);
+        const MarchingCubes::FieldKernel kernels[2] = { MarchingCubes::FieldKernel::InverseSquare,
+                                                        MarchingCubes::FieldKernel::Compact };
+        const char* kernelNames[2] = { "InverseSquare", "Compact" };
+        
+        for (int sphereCount : { 6, 64 })
+        {
+            std::vector<Sphere> sphereList = makeSpheres(sphereCount);
+            SphereSet spheres(sphereList);
+            for (int k = 0; k < 2; k++)
+            {
+                MarchingCubes::FieldParams params;
+                params.kernel = kernels[k];
+                SphereHashGrid hashGrid;
+                hashGrid.build(spheres, params.supportScale);
+                
+                const SphereHashGrid* grids[2] = { nullptr, &hashGrid };
+                for (const SphereHashGrid* grid : grids)
+                {
+                    float maxDegrees = 0.0f;
+                    int points = 0;
+                    for (int attempt = 0; attempt < CHECK_POINTS * 100 && points < CHECK_POINTS; attempt++)
+                    {
+                        glm::vec3 position(coordinate(rng), coordinate(rng), coordinate(rng));
+                        float value = MarchingCubes::calculateScalarField(position, spheres, params, grid);
+                        if (value < 0.25f || value > 4.0f)
+                            continue;
+                        
+                        glm::vec3 analytic = MarchingCubes::calculateAnalyticGradient(position, spheres, params, grid);
+                        glm::vec3 reference = MarchingCubes::calculateGradient(position, spheres, params, grid, CHECK_EPSILON);
+                        float cosine = glm::clamp(glm::dot(analytic, reference), -1.0f, 1.0f);
+                        maxDegrees = std::max(maxDegrees, glm::degrees(std::acos(cosine)));
+                        points++;
+                    }
+                    
+                    bool ok = points == CHECK_POINTS && maxDegrees <= CHECK_MAX_DEGREES;
+                    passed = passed && ok;
+                    std::cout << (ok ? "ok   " : "FAIL ") << kernelNames[k] << (grid ? " + hash grid" : "")
+                              << ", " << sphereCount << " spheres: " << points << " points, max angle "
+                              << maxDegrees << " deg (limit " << CHECK_MAX_DEGREES << ")" << std::endl;
+                }
+            }
+        }
+        return passed;
+    }
+    
+    void writeRow(std::ostream& out, const std::string& name, int sphereCount, int resolution, size_t samples,
+                  size_t cells, size_t triangles, const Timing& timing)
+    {
+        double seconds = timing.meanMs / 1000.0;
+        out << name << ',' << sphereCount << ',' << resolution << ',' << samples << ','
+            << timing.meanMs << ',' << timing.stddevMs << ',' << timing.minMs << ',' << timing.medianMs << ','
+            << (samples ? timing.meanMs * 1e6 / samples : 0.0) << ','
+            << (cells ? cells / seconds : 0.0) << ','
+            << (triangles ? triangles / seconds : 0.0) << '\n';
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+    if (options.check)
+        return checkGradients() ? 0 : 1;
+    
+    std::ofstream file;
+    if (!options.outPath.empty())
+    {
+        file.open(options.outPath);
+        if (!file)
+        {
+            std::cerr << "Cannot open " << options.outPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = options.outPath.empty() ? std::cout : file;
+    
+    out << "benchmark,spheres,resolution,samples,mean_ms,stddev_ms,min_ms,median_ms,ns_per_sample,cells_per_s,triangles_per_s\n";
+    
+    for (int sphereCount : options.sphereCounts)
+    {
+        std::vector<Sphere> sphereList = makeSpheres(sphereCount);
+        SphereSet spheres(sphereList);
+        
+        for (int resolution : options.resolutions)
+        {
+            std::vector<glm::vec3> gridPoints;
+            Timing timing = measure(options, [&]() {
+                gridPoints = MarchingCubes::generateGridPoints(GRID_SIZE, resolution);
+            });
+            size_t points = gridPoints.size();
+            size_t cells = static_cast<size_t>(resolution) * resolution * resolution;
+            writeRow(out, "generateGridPoints", sphereCount, resolution, points, 0, 0, timing);
+            
+            timing = measure(options, [&]() {
+                float sum = 0.0f;
+                for (const glm::vec3& point : gridPoints)
+                    sum += MarchingCubes::calculateScalarField(point, sphereList);
+                sink = sum;
+            });
+            writeRow(out, "calculateScalarField", sphereCount, resolution, points, 0, 0, timing);
+            
+            std::vector<float> xs(points), ys(points), zs(points), values(points);
+            for (size_t i = 0; i < points; i++)
+            {
+                xs[i] = gridPoints[i].x;
+                ys[i] = gridPoints[i].y;
+                zs[i] = gridPoints[i].z;
+            }
+            timing = measure(options, [&]() {
+                MarchingCubes::calculateScalarFieldBatch(xs.data(), ys.data(), zs.data(), values.data(), points, spheres);
+                sink = values[points / 2];
+            });
+            writeRow(out, "calculateScalarFieldBatch", sphereCount, resolution, points, 0, 0, timing);
+            
+            size_t gradientSamples = (points + GRADIENT_STRIDE - 1) / GRADIENT_STRIDE;
+            timing = measure(options, [&]() {
+                float sum = 0.0f;
+                for (size_t i = 0; i < points; i += GRADIENT_STRIDE)
+                    sum += MarchingCubes::calculateGradient(gridPoints[i], sphereList).x;
+                sink = sum;
+            });
+            writeRow(out, "calculateGradient", sphereCount, resolution, gradientSamples, 0, 0, timing);
+            
+            timing = measure(options, [&]() {
+                float sum = 0.0f;
+                for (size_t i = 0; i < points; i += GRADIENT_STRIDE)
+                    sum += MarchingCubes::calculateAnalyticGradient(gridPoints[i], spheres).x;
+                sink = sum;
+            });
+            writeRow(out, "calculateAnalyticGradient", sphereCount, resolution, gradientSamples, 0, 0, timing);
+            
+            float cellSize = GRID_SIZE / float(resolution);
+            size_t triangles = 0;
+            timing = measure(options, [&]() {
+                triangles = referencePolygonise(gridPoints, sphereList, cellSize);
+            });
+            writeRow(out, "referencePolygonise", sphereCount, resolution, 8 * cells, cells, triangles, timing);
+            
+            const MarchingCubes::Extractor extractors[2] = { MarchingCubes::Extractor::MarchingCubes,
+                                                             MarchingCubes::Extractor::SurfaceNets };
+            const char* extractorNames[2] = { "extractMesh", "extractMesh_surfaceNets" };
+            for (int e = 0; e < 2; e++)
+            {
+                MarchingCubes::MeshSettings settings;
+                settings.threadCount = options.threadCount;
+                settings.extractor = extractors[e];
+                Mesh mesh;
+                timing = measure(options, [&]() {
+                    mesh = MarchingCubes::extractMesh(spheres, GRID_SIZE, resolution, ISO_LEVEL, settings);
+                });
+                writeRow(out, extractorNames[e], sphereCount, resolution, points, cells, mesh.indices.size() / 3, timing);
+            }
+            
+            out.flush();
+        }
+    }
+    
+    return 0;
+}
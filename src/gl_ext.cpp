@@ -0,0 +1,60 @@
+#include "gl_ext.h"
+#include <cstring>
+
+PFNGLDISPATCHCOMPUTEPROC glext_glDispatchCompute = nullptr;
+PFNGLMEMORYBARRIERPROC glext_glMemoryBarrier = nullptr;
+PFNGLBINDIMAGETEXTUREPROC glext_glBindImageTexture = nullptr;
+PFNGLTEXSTORAGE3DPROC glext_glTexStorage3D = nullptr;
+PFNGLDRAWARRAYSINDIRECTPROC glext_glDrawArraysIndirect = nullptr;
+PFNGLGENTRANSFORMFEEDBACKSPROC glext_glGenTransformFeedbacks = nullptr;
+PFNGLDELETETRANSFORMFEEDBACKSPROC glext_glDeleteTransformFeedbacks = nullptr;
+PFNGLBINDTRANSFORMFEEDBACKPROC glext_glBindTransformFeedback = nullptr;
+PFNGLDRAWTRANSFORMFEEDBACKPROC glext_glDrawTransformFeedback = nullptr;
+PFNGLBUFFERSTORAGEPROC glext_glBufferStorage = nullptr;
+PFNGLGETPROGRAMBINARYPROC glext_glGetProgramBinary = nullptr;
+PFNGLPROGRAMBINARYPROC glext_glProgramBinary = nullptr;
+PFNGLPROGRAMPARAMETERIPROC glext_glProgramParameteri = nullptr;
+
+bool loadGLExtensions(GLADloadproc load)
+{
+    glext_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)load("glDispatchCompute");
+    glext_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)load("glMemoryBarrier");
+    glext_glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)load("glBindImageTexture");
+    glext_glTexStorage3D = (PFNGLTEXSTORAGE3DPROC)load("glTexStorage3D");
+    glext_glDrawArraysIndirect = (PFNGLDRAWARRAYSINDIRECTPROC)load("glDrawArraysIndirect");
+    glext_glGenTransformFeedbacks = (PFNGLGENTRANSFORMFEEDBACKSPROC)load("glGenTransformFeedbacks");
+    glext_glDeleteTransformFeedbacks = (PFNGLDELETETRANSFORMFEEDBACKSPROC)load("glDeleteTransformFeedbacks");
+    glext_glBindTransformFeedback = (PFNGLBINDTRANSFORMFEEDBACKPROC)load("glBindTransformFeedback");
+    glext_glDrawTransformFeedback = (PFNGLDRAWTRANSFORMFEEDBACKPROC)load("glDrawTransformFeedback");
+    glext_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+    glext_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+    glext_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+    glext_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+
+    return glext_glDispatchCompute && glext_glMemoryBarrier && glext_glBindImageTexture && glext_glTexStorage3D &&
+           glext_glDrawArraysIndirect && glext_glGenTransformFeedbacks && glext_glDeleteTransformFeedbacks &&
+           glext_glBindTransformFeedback && glext_glDrawTransformFeedback && glext_glGetProgramBinary &&
+           glext_glProgramBinary && glext_glProgramParameteri;
+}
+
+bool hasBufferStorage()
+{
+    if (!glext_glBufferStorage)
+        return false;
+    
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 4))
+        return true;
+    
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; i++)
+    {
+        const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (name && std::strcmp(name, "GL_ARB_buffer_storage") == 0)
+            return true;
+    }
+    return false;
+}
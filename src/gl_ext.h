@@ -0,0 +1,114 @@
+#pragma once
+
+// OpenGL 4.x tokens and entry points missing from the bundled glad header, which is generated for
+// 3.3 core. The context itself is 4.3 (see main.cpp); call loadGLExtensions after gladLoadGLLoader.
+// glBufferStorage is 4.4 and optional: check hasBufferStorage() before calling it, since drivers may
+// hand out a stub for an entry point the context does not expose.
+#include <glad/glad.h>
+
+// GL 4.3: shader storage buffers (bound with the 3.0 glBindBufferBase)
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+#define GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT 0x90DF
+#endif
+
+// GL 4.3: compute shaders
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+
+// GL 4.0: indirect draws
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// GL 4.0: transform feedback objects
+#ifndef GL_TRANSFORM_FEEDBACK
+#define GL_TRANSFORM_FEEDBACK 0x8E22
+#endif
+
+// GL 4.4: persistent mappings
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// GL 4.1: program binaries
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+// GL 4.2/4.3: glMemoryBarrier bits
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC)(GLuint unit, GLuint texture, GLint level, GLboolean layered,
+                                                   GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP PFNGLTEXSTORAGE3DPROC)(GLenum target, GLsizei levels, GLenum internalformat,
+                                               GLsizei width, GLsizei height, GLsizei depth);
+typedef void (APIENTRYP PFNGLDRAWARRAYSINDIRECTPROC)(GLenum mode, const void* indirect);
+typedef void (APIENTRYP PFNGLGENTRANSFORMFEEDBACKSPROC)(GLsizei n, GLuint* ids);
+typedef void (APIENTRYP PFNGLDELETETRANSFORMFEEDBACKSPROC)(GLsizei n, const GLuint* ids);
+typedef void (APIENTRYP PFNGLBINDTRANSFORMFEEDBACKPROC)(GLenum target, GLuint id);
+typedef void (APIENTRYP PFNGLDRAWTRANSFORMFEEDBACKPROC)(GLenum mode, GLuint id);
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length,
+                                                   GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+
+extern PFNGLDISPATCHCOMPUTEPROC glext_glDispatchCompute;
+extern PFNGLMEMORYBARRIERPROC glext_glMemoryBarrier;
+extern PFNGLBINDIMAGETEXTUREPROC glext_glBindImageTexture;
+extern PFNGLTEXSTORAGE3DPROC glext_glTexStorage3D;
+extern PFNGLDRAWARRAYSINDIRECTPROC glext_glDrawArraysIndirect;
+extern PFNGLGENTRANSFORMFEEDBACKSPROC glext_glGenTransformFeedbacks;
+extern PFNGLDELETETRANSFORMFEEDBACKSPROC glext_glDeleteTransformFeedbacks;
+extern PFNGLBINDTRANSFORMFEEDBACKPROC glext_glBindTransformFeedback;
+extern PFNGLDRAWTRANSFORMFEEDBACKPROC glext_glDrawTransformFeedback;
+extern PFNGLBUFFERSTORAGEPROC glext_glBufferStorage;
+extern PFNGLGETPROGRAMBINARYPROC glext_glGetProgramBinary;
+extern PFNGLPROGRAMBINARYPROC glext_glProgramBinary;
+extern PFNGLPROGRAMPARAMETERIPROC glext_glProgramParameteri;
+
+#define glDispatchCompute glext_glDispatchCompute
+#define glMemoryBarrier glext_glMemoryBarrier
+#define glBindImageTexture glext_glBindImageTexture
+#define glTexStorage3D glext_glTexStorage3D
+#define glDrawArraysIndirect glext_glDrawArraysIndirect
+#define glGenTransformFeedbacks glext_glGenTransformFeedbacks
+#define glDeleteTransformFeedbacks glext_glDeleteTransformFeedbacks
+#define glBindTransformFeedback glext_glBindTransformFeedback
+#define glDrawTransformFeedback glext_glDrawTransformFeedback
+#define glBufferStorage glext_glBufferStorage
+#define glGetProgramBinary glext_glGetProgramBinary
+#define glProgramBinary glext_glProgramBinary
+#define glProgramParameteri glext_glProgramParameteri
+
+// Returns false when the driver lacks any of the required entry points above
+bool loadGLExtensions(GLADloadproc load);
+
+// True when the current context is 4.4 or newer, or lists GL_ARB_buffer_storage, and the entry point loaded
+bool hasBufferStorage();
@@ -1,7 +1,13 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <random>
 #include <glad/glad.h>
+#include "gl_ext.h"
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -24,22 +30,158 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-// FPS counter variables
-int frameCount = 0;
-float fpsTimer = 0.0f;
+// Window title refresh (profiler summary)
+float titleTimer = 0.0f;
+
+// P pauses the simulation; the key is edge-triggered
+bool paused = false;
+bool pauseKeyDown = false;
 
 const float GRID_SIZE = 8.0f;
 const int GRID_RESOLUTION = 20; 
 const float ISO_LEVEL = 1.0f;
+const int BRICK_CELLS = 8;
+const int SHADER_BRICK_CELLS = 4; // бруски списков сфер для marching_cubes.geom
+const int MAX_SHADER_RESOLUTION = 40; // предел клеток на ось для --fit-grid size и --budget
+const int MIN_SHADER_RESOLUTION = 8;
+const float HEADLESS_TIMESTEP = 1.0f / 60.0f; // фиксированный шаг, чтобы прогоны были повторяемыми
+
+// count spheres spread over the central 80% of the grid, radii shrinking with the count so the
+// blobs keep roughly the size of the six-sphere scene
+void addRandomSpheres(SphereSet& spheres, int count)
+{
+    std::mt19937 rng(1234);
+    float extent = GRID_SIZE * 0.4f;
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::uniform_real_distribution<float> velocity(-0.4f, 0.4f);
+    float baseRadius = 1.0f / std::cbrt(static_cast<float>(count) / 6.0f);
+    std::uniform_real_distribution<float> radius(0.7f * baseRadius, 1.2f * baseRadius);
+    
+    spheres.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        float r = radius(rng);
+        spheres.add(Sphere(center, r, glm::vec3(velocity(rng), velocity(rng), velocity(rng))));
+    }
+}
+
+// Prints min/median/p99 of the recorded frame times
+void printFrameTimeSummary(std::vector<double> frameTimes)
+{
+    if (frameTimes.empty())
+        return;
+    std::sort(frameTimes.begin(), frameTimes.end());
+    double total = 0.0;
+    for (double t : frameTimes)
+        total += t;
+    size_t p99 = std::min(frameTimes.size() - 1, static_cast<size_t>(std::ceil(frameTimes.size() * 0.99)) - 1);
+    std::cout << "Frames: " << frameTimes.size()
+              << " | min " << frameTimes.front() << " ms"
+              << " | median " << frameTimes[frameTimes.size() / 2] << " ms"
+              << " | p99 " << frameTimes[p99] << " ms"
+              << " | mean " << total / frameTimes.size() << " ms" << std::endl;
+}
 
-int main()
+int main(int argc, char* argv[])
 {
-    glfwInit();
+    // --cpu-mesh: extract the surface on the CPU per brick and re-mesh only bricks touched by moving spheres
+    // --surface-nets: same, with surface nets instead of marching cubes
+    // --headless --frames N: no display; render N frames offscreen and print frame time statistics
+    // --profile FILE: per-phase CPU/GPU times of every frame as CSV
+    // --spheres N: N random spheres instead of the six-sphere scene
+    // --compact: compact kernel in the geometry shader, each cell summing only the spheres listed for its brick
+    // --field-volume: a compute pass writes field and gradient per lattice point; the geometry shader only samples them
+    // --compute-mesh: marching cubes in compute shaders over that field volume, drawn indirectly (no geometry shader)
+    // --paused: start with the simulation paused (P toggles)
+    // --no-capture: run the geometry shader every frame instead of redrawing its captured output while spheres rest
+    // --no-shader-cache: always compile shaders from source instead of loading binaries from shader_cache/
+    // --fit-grid size|count: shader grid follows the spheres' influence bounds each frame, keeping the cell
+    //   size (up to MAX_SHADER_RESOLUTION cells per axis) or the cell count; the CPU meshers keep the fixed grid
+    // --budget MS: adjust the shader grid resolution to keep frames within MS (turns vsync off; GPU paths only)
+    // --no-cull: mesh and draw bricks outside the view frustum too
+    // --zoom DEG: start with the camera's field of view at DEG (1-45, as the scroll wheel sets it)
+    bool cpuMesh = false;
+    bool surfaceNets = false;
+    bool compactShader = false;
+    bool fieldVolumePass = false;
+    bool computeMesh = false;
+    bool captureMesh = true;
+    bool shaderCache = true;
+    MarchingCubes::GridFit gridFit = MarchingCubes::GridFit::Fixed;
+    double budgetMs = 0.0;
+    bool cullBricks = true;
+    int randomSpheres = 0;
+    bool headless = false;
+    int frameLimit = 300;
+    std::string profilePath;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--cpu-mesh")
+            cpuMesh = true;
+        else if (arg == "--surface-nets")
+            cpuMesh = surfaceNets = true;
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--frames" && i + 1 < argc)
+            frameLimit = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--profile" && i + 1 < argc)
+            profilePath = argv[++i];
+        else if (arg == "--spheres" && i + 1 < argc)
+            randomSpheres = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--compact")
+            compactShader = true;
+        else if (arg == "--field-volume")
+            fieldVolumePass = true;
+        else if (arg == "--compute-mesh")
+            computeMesh = fieldVolumePass = true;
+        else if (arg == "--paused")
+            paused = true;
+        else if (arg == "--no-capture")
+            captureMesh = false;
+        else if (arg == "--no-shader-cache")
+            shaderCache = false;
+        else if (arg == "--budget" && i + 1 < argc)
+            budgetMs = std::max(0.0, std::atof(argv[++i]));
+        else if (arg == "--no-cull")
+            cullBricks = false;
+        else if (arg == "--zoom" && i + 1 < argc)
+            camera.ProcessMouseScroll(camera.Zoom - static_cast<float>(std::atof(argv[++i])));
+        else if (arg == "--fit-grid" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            if (mode == "size")
+                gridFit = MarchingCubes::GridFit::CellSize;
+            else if (mode == "count")
+                gridFit = MarchingCubes::GridFit::CellCount;
+        }
+    }
+    
+    // The null platform needs no display server; its contexts come from EGL (surfaceless) or OSMesa,
+    // both of which Mesa's llvmpipe provides
+    if (headless)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    if (!glfwInit())
+    {
+        std::cout << "Failed to initialize GLFW" << std::endl;
+        return -1;
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (headless)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    }
 
     GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Spheres Merging Visualization", NULL, NULL);
+    if (window == NULL && headless)
+    {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Spheres Merging Visualization", NULL, NULL);
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -47,135 +189,488 @@ int main()
         return -1;
     }
     glfwMakeContextCurrent(window);
+    // The governor reads frame times, which vsync would pin to the refresh interval
+    const bool governed = budgetMs > 0.0 && !cpuMesh;
+    if (governed && !headless)
+        glfwSwapInterval(0);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
 
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if (!headless)
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    if (!loadGLExtensions((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to load OpenGL 4.3 entry points" << std::endl;
+        return -1;
+    }
+    
+    // A surfaceless context has no default framebuffer, so headless frames go to an FBO of window size
+    unsigned int offscreenFBO = 0, offscreenColor = 0, offscreenDepth = 0;
+    if (headless)
+    {
+        glGenFramebuffers(1, &offscreenFBO);
+        glGenRenderbuffers(1, &offscreenColor);
+        glGenRenderbuffers(1, &offscreenDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreenColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, SCR_WIDTH, SCR_HEIGHT);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreenFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, offscreenDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "Offscreen framebuffer is incomplete" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    }
     
     glEnable(GL_DEPTH_TEST);
     
     std::cout << "OpenGL Version: " << glGetString(GL_VERSION) << std::endl;    
+    if (headless)
+        std::cout << "Renderer: " << glGetString(GL_RENDERER) << " | headless, " << frameLimit << " frames" << std::endl;
 
-    Shader marchingCubesShader("shaders/marching_cubes.vert", "shaders/marching_cubes.geom", "shaders/marching_cubes.frag");
+    // Only the geometry shader path records its output; the CPU and compute meshers have a mesh already
+    captureMesh = captureMesh && !cpuMesh && !computeMesh;
     
-    std::vector<Sphere> spheres;
-    spheres.push_back(Sphere(glm::vec3(-1.5f, 0.0f, 0.0f), 1.0f, glm::vec3(0.5f, 0.0f, 0.0f)));
-    spheres.push_back(Sphere(glm::vec3(1.5f, 0.0f, 0.0f), 1.2f, glm::vec3(-0.3f, 0.2f, 0.0f)));
-    spheres.push_back(Sphere(glm::vec3(0.0f, 2.0f, 0.0f), 0.8f, glm::vec3(0.0f, -0.4f, 0.3f)));
-    spheres.push_back(Sphere(glm::vec3(0.0f, -1.5f, 0.0f), 0.9f, glm::vec3(0.3f, 0.3f, 0.0f)));
-    spheres.push_back(Sphere(glm::vec3(-2.0f, -1.0f, 0.0f), 0.7f, glm::vec3(0.2f, -0.3f, 0.4f)));
-    spheres.push_back(Sphere(glm::vec3(2.0f, 1.0f, 0.0f), 1.1f, glm::vec3(-0.4f, 0.1f, -0.2f)));
+    // Compiled programs are cached in shader_cache/ beside shaders/; the first launch after a
+    // shader or driver change compiles from source and refreshes the cache
+    if (shaderCache)
+        Shader::setBinaryCacheDirectory("shader_cache");
+    auto shaderStart = std::chrono::steady_clock::now();
+    std::vector<const char*> capturedVaryings;
+    if (captureMesh)
+        capturedVaryings = { "FragPos", "Normal" };
+    Shader marchingCubesShader("shaders/marching_cubes.vert", "shaders/marching_cubes.geom", "shaders/marching_cubes.frag",
+                               fieldVolumePass ? "#define FIELD_VOLUME\n" : "", capturedVaryings);
+    Shader meshShader("shaders/mesh.vert", "shaders/marching_cubes.frag");
     
-//     struct Sphere {
-//     glm::vec3 position;   // Где находится
-//     float radius;         // Размер
-//     glm::vec3 velocity;   // Куда движется 
-//     glm::vec3 color;      // Цвет 
-// };
+    SphereSet spheres;
+    if (randomSpheres > 0)
+    {
+        addRandomSpheres(spheres, randomSpheres);
+    }
+    else
+    {
+        spheres.add(Sphere(glm::vec3(-1.5f, 0.0f, 0.0f), 1.0f, glm::vec3(0.5f, 0.0f, 0.0f)));
+        spheres.add(Sphere(glm::vec3(1.5f, 0.0f, 0.0f), 1.2f, glm::vec3(-0.3f, 0.2f, 0.0f)));
+        spheres.add(Sphere(glm::vec3(0.0f, 2.0f, 0.0f), 0.8f, glm::vec3(0.0f, -0.4f, 0.3f)));
+        spheres.add(Sphere(glm::vec3(0.0f, -1.5f, 0.0f), 0.9f, glm::vec3(0.3f, 0.3f, 0.0f)));
+        spheres.add(Sphere(glm::vec3(-2.0f, -1.0f, 0.0f), 0.7f, glm::vec3(0.2f, -0.3f, 0.4f)));
+        spheres.add(Sphere(glm::vec3(2.0f, 1.0f, 0.0f), 1.1f, glm::vec3(-0.4f, 0.1f, -0.2f)));
+    }
 
     std::cout << "Создано сфер: " << spheres.size() << std::endl;
 
-    std::vector<glm::vec3> gridPoints = MarchingCubes::generateGridPoints(GRID_SIZE, GRID_RESOLUTION);
+    // GPU resources are sized for the largest grid the fit or the governor can produce
+    const int maxShaderResolution = gridFit == MarchingCubes::GridFit::CellSize || governed ? MAX_SHADER_RESOLUTION : GRID_RESOLUTION;
     
-    std::cout << "Создано точек сетки: " << gridPoints.size() << std::endl;
+    // One point per cell; marching_cubes.vert derives its position from gl_VertexID, so the draw needs
+    // no vertex buffer, only an empty VAO (core profile refuses draws without one)
+    std::cout << "Создано точек сетки: " << GRID_RESOLUTION * GRID_RESOLUTION * GRID_RESOLUTION
+              << (gridFit == MarchingCubes::GridFit::Fixed ? "" : " (grid fitted to the spheres every frame)") << std::endl;
 
-    unsigned int VBO, VAO;
+    unsigned int VAO;
     glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
     
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, gridPoints.size() * sizeof(glm::vec3), &gridPoints[0], GL_STATIC_DRAW);
+    // The compact kernel bounds each sphere's reach, which is what lets a brick stay untouched
+    MarchingCubes::MeshSettings meshSettings;
+    meshSettings.field.kernel = MarchingCubes::FieldKernel::Compact;
+    if (surfaceNets)
+        meshSettings.extractor = MarchingCubes::Extractor::SurfaceNets;
+    BrickMesher brickMesher(GRID_SIZE, GRID_RESOLUTION, BRICK_CELLS);
+    std::vector<std::unique_ptr<MeshBuffer>> brickBuffers;
+    std::vector<unsigned int> uploadedVersions;
+    // Last frame's bricks with a mesh or a pending re-mesh, split into drawn and culled
+    int cpuBricksDrawn = 0, cpuBricksCulled = 0;
+    if (cpuMesh)
+    {
+        for (size_t i = 0; i < brickMesher.getBricks().size(); i++)
+            brickBuffers.push_back(std::make_unique<MeshBuffer>());
+        uploadedVersions.assign(brickBuffers.size(), 0);
+        std::cout << "CPU mesh (" << (surfaceNets ? "surface nets" : "marching cubes") << "): "
+                  << brickBuffers.size() << " bricks" << std::endl;
+    }
+
+    std::unique_ptr<FrameProfiler> profiler = std::make_unique<FrameProfiler>();
+    const int integratePhase = profiler->addPhase("integrate");
+    const int meshPhase = profiler->addPhase("mesh");
+    const int fieldPhase = profiler->addPhase("field");
+    const int uniformPhase = profiler->addPhase("uniforms");
+    const int drawPhase = profiler->addPhase("draw");
+    // Of the bricks with surface to mesh (shader: reached by a sphere; CPU: holding a mesh or a pending
+    // re-mesh), those drawn this frame and those skipped for lying outside the view frustum. The compute
+    // mesher covers the whole grid, so it has no brick counts.
+    const bool brickCounters = cpuMesh || !computeMesh;
+    const int visibleCounter = brickCounters ? profiler->addCounter("visible_bricks") : -1;
+    const int culledCounter = brickCounters ? profiler->addCounter("culled_bricks") : -1;
+    if (!profilePath.empty())
+        profiler->startCsv(profilePath);
     
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-    glEnableVertexAttribArray(0);
+    // Per-frame shader data: one std140 block for every program, filled in place and uploaded once a frame
+    std::unique_ptr<UniformBuffer> frameUniforms = std::make_unique<UniformBuffer>(sizeof(FrameUniforms), FRAME_UNIFORM_BINDING);
+    FrameUniforms frameData = {};
+    frameData.model = glm::mat4(1.0f);
+    frameData.lightPos = glm::vec3(5.0f, 5.0f, 5.0f);
+    frameData.lightColor = glm::vec3(1.0f, 1.0f, 1.0f);
+    frameData.isoLevel = ISO_LEVEL;
     
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0); 
-
-    while (!glfwWindowShouldClose(window))
+    // Geometry shader sphere data, sized at runtime: the SphereSet arrays, and with the compact kernel
+    // the per-brick sphere lists rebuilt every frame so each cell loops only over spheres that reach it
+    MarchingCubes::FieldParams shaderField;
+    if (compactShader)
+        shaderField.kernel = MarchingCubes::FieldKernel::Compact;
+    frameData.supportScale = compactShader ? shaderField.supportScale : 0.0f;
+    // Cells of the geometry shader and compute passes, refitted whenever the spheres are uploaded
+    MarchingCubes::GridRegion shaderGrid = MarchingCubes::GridRegion::cube(GRID_SIZE, GRID_RESOLUTION);
+    int shaderResolution = GRID_RESOLUTION;
+    MarchingCubes::BrickSphereLists brickLists;
+    // Geometry shader draws cover only the bricks some sphere reaches: with the compact kernel the ones
+    // with a non-empty sphere list, otherwise those inside the influence bounds. Of those, only the bricks
+    // in the view frustum are drawn.
+    std::vector<int> activeBricks;
+    std::vector<int> visibleBricks;
+    std::vector<glm::ivec4> activeBrickOrigins;
+    int shaderBrickCount = 0;
+    std::unique_ptr<StorageBuffer> activeBrickStorage = std::make_unique<StorageBuffer>(ACTIVE_BRICK_STORAGE_BINDING);
+    // Sphere state streams through a 3-deep ring of persistently mapped regions, so writing this frame's
+    // spheres never waits on the GPU reading the previous ones
+    std::unique_ptr<StreamingStorageBuffer> sphereStorage = std::make_unique<StreamingStorageBuffer>(SPHERE_STORAGE_BINDING);
+    if (!sphereStorage->isPersistent())
+        std::cout << "glBufferStorage unavailable: sphere data goes through glBufferSubData" << std::endl;
+    std::unique_ptr<StorageBuffer> brickListStorage = std::make_unique<StorageBuffer>(BRICK_LIST_STORAGE_BINDING);
+    std::unique_ptr<StorageBuffer> brickIndexStorage = std::make_unique<StorageBuffer>(BRICK_INDEX_STORAGE_BINDING);
+    // The lookup tables are read from one buffer by every geometry-shader invocation (and by the compute
+    // mesher) instead of being initialised as arrays inside each invocation
+    std::unique_ptr<StorageBuffer> tableStorage = std::make_unique<StorageBuffer>(TABLE_STORAGE_BINDING);
+    std::vector<int> tables = MarchingCubes::packTables();
+    tableStorage->reserve(tables.size() * sizeof(int));
+    tableStorage->write(0, tables.data(), tables.size() * sizeof(int));
+    
+    // Two-pass variant: each lattice point's field is summed once instead of by up to 8 cells
+    std::unique_ptr<Shader> fieldVolumeShader;
+    std::unique_ptr<FieldVolume> fieldVolume;
+    std::unique_ptr<ComputeMesher> computeMesher;
+    if (fieldVolumePass && !cpuMesh)
+    {
+        fieldVolumeShader = std::make_unique<Shader>("shaders/field_volume.comp");
+        fieldVolume = std::make_unique<FieldVolume>(maxShaderResolution);
+        if (computeMesh)
+            computeMesher = std::make_unique<ComputeMesher>(maxShaderResolution);
+    }
+    std::cout << "Shader programs ready in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStart).count()
+              << " ms" << (shaderCache ? "" : " (cache disabled)") << std::endl;
+    
+    // The geometry shader's triangles are recorded while they are drawn; until a sphere changes, later
+    // frames redraw the recording through mesh.vert. Sized for five triangles in every cell.
+    std::unique_ptr<FeedbackMesh> feedbackMesh;
+    if (captureMesh)
+    {
+        feedbackMesh = std::make_unique<FeedbackMesh>(static_cast<size_t>(maxShaderResolution) * maxShaderResolution * maxShaderResolution * 15);
+    }
+    // Grid resolution for the shader passes: GRID_RESOLUTION, or the governor's choice under --budget
+    std::unique_ptr<ResolutionGovernor> governor;
+    if (governed)
     {
-        float currentFrame = static_cast<float>(glfwGetTime());
+        governor = std::make_unique<ResolutionGovernor>(budgetMs, GRID_RESOLUTION, MIN_SHADER_RESOLUTION, MAX_SHADER_RESOLUTION);
+        std::cout << "Resolution governor: " << budgetMs << " ms budget, " << MIN_SHADER_RESOLUTION << "-"
+                  << MAX_SHADER_RESOLUTION << " cells per axis" << std::endl;
+    }
+    int gridResolution = GRID_RESOLUTION;
+    
+    // Sphere revision, grid resolution and visible bricks the captured or compute-built mesh was made from
+    bool gpuMeshValid = false;
+    unsigned int gpuMeshRevision = 0;
+    int gpuMeshResolution = 0;
+    std::vector<int> gpuMeshBricks;
+    
+    std::vector<double> frameTimes;
+    int frameIndex = 0;
+    
+    while (!glfwWindowShouldClose(window) && (!headless || frameIndex < frameLimit))
+    {
+        auto frameStart = std::chrono::steady_clock::now();
+        float currentFrame = headless ? frameIndex * HEADLESS_TIMESTEP : static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        frameIndex++;
+        profiler->beginFrame();
 
-        // FPS counter
-        frameCount++;
-        fpsTimer += deltaTime;
-        if (fpsTimer >= 1.0f)
+        // FPS and per-phase CPU/GPU ms, averaged over the last second
+        titleTimer += deltaTime;
+        if (titleTimer >= 1.0f && !headless)
         {
-            float fps = frameCount / fpsTimer;
-            // std::cout << "FPS: " << static_cast<int>(fps) << std::endl;
-            std::string title = "Spheres Merging Visualization | FPS: " + std::to_string(static_cast<int>(fps));
+            std::string title = "Spheres Merging Visualization | ";
+            if (!cpuMesh)
+            {
+                title += "grid " + std::to_string(shaderResolution) + "^3";
+                if (!computeMesher)
+                    title += ", bricks " + std::to_string(activeBricks.size()) + "/" + std::to_string(shaderBrickCount);
+                title += " | ";
+            }
+            title += profiler->takeSummary();
             glfwSetWindowTitle(window, title.c_str());
-            frameCount = 0;
-            fpsTimer = 0.0f;
+            titleTimer = 0.0f;
         }
 
-        processInput(window);
+        if (!headless)
+            processInput(window);
         
-        for (auto& sphere : spheres)
+        if (!paused)
         {
-            sphere.position += sphere.velocity * deltaTime;
-            
-            float boundary = GRID_SIZE * 0.4f;
-            if (sphere.position.x > boundary || sphere.position.x < -boundary)
-                sphere.velocity.x *= -1;
-            if (sphere.position.y > boundary || sphere.position.y < -boundary)
-                sphere.velocity.y *= -1;
-            if (sphere.position.z > boundary || sphere.position.z < -boundary)
-                sphere.velocity.z *= -1;
+            FrameProfiler::Scope scope(*profiler, integratePhase);
+            spheres.integrate(deltaTime, GRID_SIZE * 0.4f);
         }
+        bool reuseGpuMesh = (feedbackMesh || computeMesher) && gpuMeshValid && gpuMeshRevision == spheres.revision &&
+                            gpuMeshResolution == gridResolution;
 
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        marchingCubesShader.use();
-        
-        glm::mat4 model = glm::mat4(1.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 
-                                              (float)SCR_WIDTH / (float)SCR_HEIGHT, 
-                                              0.1f, 100.0f);
-        
-        marchingCubesShader.setMat4("model", model);
-        marchingCubesShader.setMat4("view", view);
-        marchingCubesShader.setMat4("projection", projection);
+        // Brick boxes are in grid space, so the planes come from the full model-view-projection
+        Frustum frustum(glm::mat4(1.0f));
+        {
+            FrameProfiler::Scope scope(*profiler, uniformPhase);
+            frameData.view = camera.GetViewMatrix();
+            frameData.projection = glm::perspective(glm::radians(camera.Zoom), 
+                                                    (float)SCR_WIDTH / (float)SCR_HEIGHT, 
+                                                    0.1f, 100.0f);
+            frameData.viewPos = camera.Position;
+            frameData.numSpheres = static_cast<int>(spheres.size());
+            frustum = Frustum(frameData.projection * frameData.view * frameData.model);
+            
+            // A captured mesh holds only the bricks that were in view when it was recorded
+            if (reuseGpuMesh && feedbackMesh && cullBricks)
+            {
+                MarchingCubes::cullBricks(shaderGrid, SHADER_BRICK_CELLS, frustum, activeBricks, visibleBricks);
+                reuseGpuMesh = visibleBricks == gpuMeshBricks;
+            }
+            if (!cpuMesh && !reuseGpuMesh)
+            {
+                shaderGrid = MarchingCubes::fitGrid(spheres, shaderField, ISO_LEVEL, gridFit, GRID_SIZE,
+                                                    gridResolution, maxShaderResolution);
+                shaderResolution = shaderGrid.end.x;
+            }
+            frameData.gridOrigin = shaderGrid.origin;
+            frameData.gridSize = shaderGrid.cellSize * shaderResolution;
+            frameData.gridResolution = shaderResolution;
+            frameUniforms->update(&frameData, sizeof(frameData));
+            
+            if (!cpuMesh && !reuseGpuMesh)
+            {
+                void* sphereData = sphereStorage->beginWrite(4 * spheres.size() * sizeof(float));
+                spheres.writeShaderData(static_cast<float*>(sphereData));
+                sphereStorage->endWrite();
+                
+                if (compactShader)
+                {
+                    MarchingCubes::buildBrickSphereLists(spheres, shaderGrid, SHADER_BRICK_CELLS, shaderField, brickLists);
+                    int header[4] = { brickLists.bricks.x, brickLists.bricks.y, brickLists.bricks.z, brickLists.brickCells };
+                    size_t startBytes = brickLists.brickStart.size() * sizeof(int);
+                    size_t indexBytes = brickLists.sphereIndices.size() * sizeof(int);
+                    brickListStorage->reserve(sizeof(header) + startBytes);
+                    brickListStorage->write(0, header, sizeof(header));
+                    brickListStorage->write(sizeof(header), brickLists.brickStart.data(), startBytes);
+                    brickIndexStorage->reserve(indexBytes);
+                    brickIndexStorage->write(0, brickLists.sphereIndices.data(), indexBytes);
+                }
+                
+                if (!computeMesher)
+                {
+                    glm::vec3 boundsMin, boundsMax;
+                    if (compactShader)
+                        activeBricks = brickLists.activeBricks;
+                    else if (MarchingCubes::influenceBounds(spheres, shaderField, ISO_LEVEL, boundsMin, boundsMax))
+                        MarchingCubes::bricksInBox(shaderGrid, SHADER_BRICK_CELLS, boundsMin, boundsMax, activeBricks);
+                    else
+                        activeBricks.clear();
+                    
+                    if (cullBricks)
+                        MarchingCubes::cullBricks(shaderGrid, SHADER_BRICK_CELLS, frustum, activeBricks, visibleBricks);
+                    else
+                        visibleBricks = activeBricks;
+                    
+                    glm::ivec3 bricks = (shaderGrid.end - shaderGrid.begin + SHADER_BRICK_CELLS - 1) / SHADER_BRICK_CELLS;
+                    shaderBrickCount = bricks.x * bricks.y * bricks.z;
+                    activeBrickOrigins.resize(visibleBricks.size() + 1);
+                    activeBrickOrigins[0] = glm::ivec4(SHADER_BRICK_CELLS, 0, 0, 0);
+                    for (size_t i = 0; i < visibleBricks.size(); i++)
+                    {
+                        int b = visibleBricks[i];
+                        glm::ivec3 brick(b % bricks.x, (b / bricks.x) % bricks.y, b / (bricks.x * bricks.y));
+                        activeBrickOrigins[i + 1] = glm::ivec4(shaderGrid.begin + brick * SHADER_BRICK_CELLS, 0);
+                    }
+                    size_t originBytes = activeBrickOrigins.size() * sizeof(glm::ivec4);
+                    activeBrickStorage->reserve(originBytes);
+                    activeBrickStorage->write(0, activeBrickOrigins.data(), originBytes);
+                }
+            }
+            
+            if (!cpuMesh && !computeMesher)
+            {
+                profiler->setCounter(visibleCounter, static_cast<float>(visibleBricks.size()));
+                profiler->setCounter(culledCounter, static_cast<float>(activeBricks.size() - visibleBricks.size()));
+            }
+        }
         
-        marchingCubesShader.setFloat("gridSize", GRID_SIZE);
-        marchingCubesShader.setInt("gridResolution", GRID_RESOLUTION);
-        marchingCubesShader.setFloat("isoLevel", ISO_LEVEL);
+        if (cpuMesh)
+        {
+            {
+                FrameProfiler::Scope scope(*profiler, meshPhase);
+                brickMesher.update(spheres, ISO_LEVEL, meshSettings, cullBricks ? &frustum : nullptr);
+                
+                // Only bricks whose mesh changed since the last frame go back to the GPU
+                const std::vector<BrickMesher::Brick>& bricks = brickMesher.getBricks();
+                for (size_t i = 0; i < bricks.size(); i++)
+                {
+                    if (bricks[i].version != uploadedVersions[i])
+                    {
+                        brickBuffers[i]->upload(bricks[i].mesh);
+                        uploadedVersions[i] = bricks[i].version;
+                    }
+                }
+            }
+            
+            FrameProfiler::Scope scope(*profiler, drawPhase);
+            meshShader.use();
+            const std::vector<BrickMesher::Brick>& bricks = brickMesher.getBricks();
+            cpuBricksDrawn = cpuBricksCulled = 0;
+            for (size_t i = 0; i < bricks.size(); i++)
+            {
+                if (bricks[i].mesh.indices.empty() && !bricks[i].stale)
+                    continue;
+                if (!bricks[i].visible)
+                {
+                    cpuBricksCulled++;
+                    continue;
+                }
+                brickBuffers[i]->draw();
+                cpuBricksDrawn++;
+            }
+            profiler->setCounter(visibleCounter, static_cast<float>(cpuBricksDrawn));
+            profiler->setCounter(culledCounter, static_cast<float>(cpuBricksCulled));
+        }
+        else
+        {
+            if (fieldVolume && !reuseGpuMesh)
+            {
+                FrameProfiler::Scope scope(*profiler, fieldPhase);
+                fieldVolumeShader->use();
+                fieldVolume->compute(shaderResolution);
+            }
+            
+            if (computeMesher)
+            {
+                if (!reuseGpuMesh)
+                {
+                    FrameProfiler::Scope scope(*profiler, meshPhase);
+                    computeMesher->extract(shaderResolution);
+                }
+                
+                FrameProfiler::Scope scope(*profiler, drawPhase);
+                meshShader.use();
+                computeMesher->draw();
+            }
+            else if (reuseGpuMesh)
+            {
+                FrameProfiler::Scope scope(*profiler, drawPhase);
+                meshShader.use();
+                // The recording holds world-space FragPos and Normal, so model must not be applied again
+                meshShader.setBool("worldSpaceInput", true);
+                feedbackMesh->draw();
+                meshShader.setBool("worldSpaceInput", false);
+            }
+            else
+            {
+                FrameProfiler::Scope scope(*profiler, drawPhase);
+                marchingCubesShader.use();
+                glBindVertexArray(VAO);
+                if (feedbackMesh)
+                    feedbackMesh->begin();
+                glDrawArraysInstanced(GL_POINTS, 0, SHADER_BRICK_CELLS * SHADER_BRICK_CELLS * SHADER_BRICK_CELLS,
+                                      static_cast<GLsizei>(visibleBricks.size()));
+                if (feedbackMesh)
+                    feedbackMesh->end();
+                gpuMeshBricks = visibleBricks;
+            }
+            gpuMeshValid = true;
+            gpuMeshRevision = spheres.revision;
+            gpuMeshResolution = gridResolution;
+        }
+
+        sphereStorage->fence();
         
-        marchingCubesShader.setInt("numSpheres", static_cast<int>(spheres.size()));
-        for (size_t i = 0; i < spheres.size() && i < 6; ++i) // i < 6 - max 6 сфер
+        if (headless)
         {
-            std::string spherePosName = "spherePositions[" + std::to_string(i) + "]";
-            std::string sphereRadName = "sphereRadii[" + std::to_string(i) + "]";
-            marchingCubesShader.setVec3(spherePosName, spheres[i].position);
-            marchingCubesShader.setFloat(sphereRadName, spheres[i].radius);
+            // Nothing is presented, so wait for the GPU to make the frame time include its work
+            glFinish();
         }
+        else
+        {
+            glfwSwapBuffers(window);
+        }
+        double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+        if (headless)
+            frameTimes.push_back(frameMs);
         
-        glm::vec3 lightPos(5.0f, 5.0f, 5.0f);
-        marchingCubesShader.setVec3("lightPos", lightPos);
-        marchingCubesShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 1.0f));
-        marchingCubesShader.setVec3("viewPos", camera.Position);
-
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(gridPoints.size()));
-
-        glfwSwapBuffers(window);
+        // Only frames that rebuilt the mesh tell what the grid costs; redrawing a captured one does not
+        if (governor && !reuseGpuMesh)
+        {
+            int previous = governor->resolution();
+            if (governor->update(frameMs))
+            {
+                gridResolution = governor->resolution();
+                std::cout << "Grid resolution " << previous << " -> " << gridResolution << " (median frame "
+                          << governor->medianMs() << " ms, budget " << budgetMs << " ms)" << std::endl;
+            }
+        }
         glfwPollEvents();
     }
+    
+    if (headless)
+    {
+        printFrameTimeSummary(frameTimes);
+        if (!cpuMesh && !computeMesher)
+            std::cout << "Shader bricks in the last frame: " << visibleBricks.size() << " drawn, "
+                      << activeBricks.size() - visibleBricks.size() << " culled, " << shaderBrickCount - activeBricks.size()
+                      << " empty" << std::endl;
+        if (cpuMesh)
+            std::cout << "CPU bricks in the last frame: " << cpuBricksDrawn << " drawn, " << cpuBricksCulled << " culled, "
+                      << brickMesher.getBricks().size() - cpuBricksDrawn - cpuBricksCulled << " empty" << std::endl;
+        profiler->finish();
+        std::cout << "Phases (CPU/GPU): " << profiler->takeSummary() << std::endl;
+    }
+    profiler.reset();
 
     glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    brickBuffers.clear();
+    frameUniforms.reset();
+    sphereStorage.reset();
+    brickListStorage.reset();
+    brickIndexStorage.reset();
+    activeBrickStorage.reset();
+    tableStorage.reset();
+    computeMesher.reset();
+    feedbackMesh.reset();
+    fieldVolume.reset();
+    fieldVolumeShader.reset();
+    if (headless)
+    {
+        glDeleteFramebuffers(1, &offscreenFBO);
+        glDeleteRenderbuffers(1, &offscreenColor);
+        glDeleteRenderbuffers(1, &offscreenDepth);
+    }
 
     glfwTerminate();
     return 0;
@@ -186,6 +681,11 @@ void processInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
     
+    bool pausePressed = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (pausePressed && !pauseKeyDown)
+        paused = !paused;
+    pauseKeyDown = pausePressed;
+    
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.ProcessKeyboard(FORWARD, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -2,7 +2,25 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <limits>
+#include <filesystem>
+#include <iterator>
 #include <glad/glad.h>
+#include "gl_ext.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define METABALLS_SSE2
+#endif
 
 Camera::Camera(glm::vec3 position, glm::vec3 up, float yaw, float pitch) 
     : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(2.5f), MouseSensitivity(0.1f), Zoom(45.0f)
@@ -77,73 +95,187 @@ void Camera::updateCameraVectors()
     Up = glm::normalize(glm::cross(Right, Front));
 }
 
+Frustum::Frustum(const glm::mat4& viewProjection)
+{
+    // Row i of the column-major glm matrix; clip space is inside when -w <= x, y, z <= w
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    for (int i = 0; i < 3; i++)
+    {
+        planes[2 * i] = rows[3] + rows[i];
+        planes[2 * i + 1] = rows[3] - rows[i];
+    }
+}
+
+bool Frustum::intersects(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+{
+    for (const glm::vec4& plane : planes)
+    {
+        // Box corner farthest along the plane normal
+        glm::vec3 corner(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+                         plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                         plane.z >= 0.0f ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+std::string Shader::binaryCacheDirectory;
+
+void Shader::setBinaryCacheDirectory(const std::string& directory)
+{
+    binaryCacheDirectory = directory;
+    if (!directory.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+    }
+}
+
 Shader::Shader(const std::string& vertexPath, const std::string& fragmentPath)
 {
-    std::string vertexCode = readFile(vertexPath);
-    std::string fragmentCode = readFile(fragmentPath);
-    
-    const char* vShaderCode = vertexCode.c_str();
-    const char* fShaderCode = fragmentCode.c_str();
+    build({ { GL_VERTEX_SHADER, readFile(vertexPath) },
+            { GL_FRAGMENT_SHADER, readFile(fragmentPath) } });
+}
+
+Shader::Shader(const std::string& vertexPath, const std::string& geometryPath, const std::string& fragmentPath,
+               const std::string& defines, const std::vector<const char*>& feedbackVaryings)
+{
+    build({ { GL_VERTEX_SHADER, insertDefines(readFile(vertexPath), defines) },
+            { GL_GEOMETRY_SHADER, insertDefines(readFile(geometryPath), defines) },
+            { GL_FRAGMENT_SHADER, insertDefines(readFile(fragmentPath), defines) } },
+          feedbackVaryings);
+}
+
+Shader::Shader(const std::string& computePath)
+{
+    build({ { GL_COMPUTE_SHADER, readFile(computePath) } });
+}
+
+void Shader::build(const std::vector<std::pair<unsigned int, std::string>>& stages,
+                   const std::vector<const char*>& feedbackVaryings)
+{
+    ID = glCreateProgram();
     
-    unsigned int vertex, fragment;
+    // glGetString may return NULL on error; without the driver strings no key is safe, so skip the cache
+    const GLubyte* vendor = glGetString(GL_VENDOR);
+    const GLubyte* renderer = glGetString(GL_RENDERER);
+    const GLubyte* version = glGetString(GL_VERSION);
     
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    checkCompileErrors(vertex, "VERTEX");
+    std::string cachePath;
+    if (!binaryCacheDirectory.empty() && vendor && renderer && version)
+    {
+        // FNV-1a over everything the binary depends on: sources, captured outputs and the driver.
+        // Each piece is followed by a 0xff byte so that boundaries shift the hash.
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const char* text) {
+            for (const unsigned char* c = reinterpret_cast<const unsigned char*>(text); *c; c++)
+                hash = (hash ^ *c) * 1099511628211ull;
+            hash = (hash ^ 0xffu) * 1099511628211ull;
+        };
+        mix(reinterpret_cast<const char*>(vendor));
+        mix(reinterpret_cast<const char*>(renderer));
+        mix(reinterpret_cast<const char*>(version));
+        for (const auto& stage : stages)
+        {
+            mix(std::to_string(stage.first).c_str());
+            mix(stage.second.c_str());
+        }
+        for (const char* varying : feedbackVaryings)
+            mix(varying);
+        
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+        cachePath = binaryCacheDirectory + "/" + name;
+        if (loadBinary(cachePath))
+            return;
+    }
     
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    checkCompileErrors(fragment, "FRAGMENT");
+    std::vector<unsigned int> shaders;
+    for (const auto& stage : stages)
+    {
+        const char* code = stage.second.c_str();
+        unsigned int shader = glCreateShader(stage.first);
+        glShaderSource(shader, 1, &code, NULL);
+        glCompileShader(shader);
+        checkCompileErrors(shader, stageName(stage.first));
+        glAttachShader(ID, shader);
+        shaders.push_back(shader);
+    }
     
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
+    if (!feedbackVaryings.empty())
+        glTransformFeedbackVaryings(ID, static_cast<GLsizei>(feedbackVaryings.size()), feedbackVaryings.data(),
+                                    GL_INTERLEAVED_ATTRIBS);
+    if (!cachePath.empty())
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
     
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    for (unsigned int shader : shaders)
+        glDeleteShader(shader);
+    
+    if (!cachePath.empty())
+        saveBinary(cachePath);
 }
 
-Shader::Shader(const std::string& vertexPath, const std::string& geometryPath, const std::string& fragmentPath)
+bool Shader::loadBinary(const std::string& path)
 {
-    std::string vertexCode = readFile(vertexPath);
-    std::string geometryCode = readFile(geometryPath);
-    std::string fragmentCode = readFile(fragmentPath);
-    
-    const char* vShaderCode = vertexCode.c_str();
-    const char* gShaderCode = geometryCode.c_str();
-    const char* fShaderCode = fragmentCode.c_str();
-    
-    unsigned int vertex, geometry, fragment;
-    
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    checkCompileErrors(vertex, "VERTEX");
+    // File layout: the GLenum binary format, then the driver's blob
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    GLenum format = 0;
+    file.read(reinterpret_cast<char*>(&format), sizeof(format));
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file.eof() || binary.empty())
+        return false;
     
-    geometry = glCreateShader(GL_GEOMETRY_SHADER);
-    glShaderSource(geometry, 1, &gShaderCode, NULL);
-    glCompileShader(geometry);
-    checkCompileErrors(geometry, "GEOMETRY");
-    
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    checkCompileErrors(fragment, "FRAGMENT");
+    // A driver that no longer accepts the blob just fails the link; the caller then compiles from source
+    glProgramBinary(ID, format, binary.data(), static_cast<GLsizei>(binary.size()));
+    int success = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    return success != 0;
+}
+
+void Shader::saveBinary(const std::string& path)
+{
+    int success = 0, length = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!success || length <= 0)
+        return;
     
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, geometry);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-    checkCompileErrors(ID, "PROGRAM");
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(ID, length, &length, &format, binary.data());
     
-    glDeleteShader(vertex);
-    glDeleteShader(geometry);
-    glDeleteShader(fragment);
+    // Written under a temporary name and renamed, so a concurrent launch never reads half a file
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return;
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(binary.data(), length);
+        if (!file)
+            return;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+}
+
+const char* Shader::stageName(unsigned int type)
+{
+    switch (type)
+    {
+    case GL_VERTEX_SHADER: return "VERTEX";
+    case GL_GEOMETRY_SHADER: return "GEOMETRY";
+    case GL_FRAGMENT_SHADER: return "FRAGMENT";
+    case GL_COMPUTE_SHADER: return "COMPUTE";
+    default: return "UNKNOWN";
+    }
 }
 
 void Shader::use()
@@ -153,27 +285,43 @@ void Shader::use()
 
 void Shader::setBool(const std::string& name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(uniformLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(uniformLocation(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(uniformLocation(name), value);
 }
 
 void Shader::setVec3(const std::string& name, const glm::vec3& value) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(uniformLocation(name), 1, &value[0]);
 }
 
 void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+void Shader::setFloatArray(const std::string& name, const float* values, int count) const
+{
+    glUniform1fv(uniformLocation(name), count, values);
+}
+
+int Shader::uniformLocation(const std::string& name) const
+{
+    auto cached = uniformLocations.find(name);
+    if (cached != uniformLocations.end())
+        return cached->second;
+    
+    int location = glGetUniformLocation(ID, name.c_str());
+    uniformLocations.emplace(name, location);
+    return location;
 }
 
 void Shader::checkCompileErrors(unsigned int shader, std::string type)
@@ -200,6 +348,17 @@ void Shader::checkCompileErrors(unsigned int shader, std::string type)
     }
 }
 
+std::string Shader::insertDefines(const std::string& code, const std::string& defines)
+{
+    // #version has to stay the first line
+    if (defines.empty())
+        return code;
+    size_t lineEnd = code.find('\n');
+    if (code.compare(0, 8, "#version") != 0 || lineEnd == std::string::npos)
+        return defines + code;
+    return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+}
+
 std::string Shader::readFile(const std::string& filePath)
 {
     std::string content;
@@ -222,29 +381,564 @@ std::string Shader::readFile(const std::string& filePath)
     return content;
 }
 
+UniformBuffer::UniformBuffer(size_t size, unsigned int binding)
+{
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+}
+
+UniformBuffer::~UniformBuffer()
+{
+    glDeleteBuffers(1, &ID);
+}
+
+void UniformBuffer::update(const void* data, size_t size)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+StorageBuffer::StorageBuffer(unsigned int binding) : capacity(0)
+{
+    glGenBuffers(1, &ID);
+    reserve(16);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, ID);
+}
+
+StorageBuffer::~StorageBuffer()
+{
+    glDeleteBuffers(1, &ID);
+}
+
+void StorageBuffer::reserve(size_t size)
+{
+    if (size <= capacity)
+        return;
+    // Grows by half again at least, so a slowly rising sphere count does not reallocate every frame
+    capacity = std::max(size, capacity + capacity / 2);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void StorageBuffer::write(size_t offset, const void* data, size_t size)
+{
+    if (size == 0)
+        return;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+StreamingStorageBuffer::StreamingStorageBuffer(unsigned int binding)
+    : binding(binding), persistent(hasBufferStorage())
+{
+    // Every region starts at a legal glBindBufferRange offset
+    int alignment = 0;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    offsetAlignment = static_cast<size_t>(std::max(alignment, 1));
+    allocate(256);
+}
+
+StreamingStorageBuffer::~StreamingStorageBuffer()
+{
+    release();
+}
+
+void* StreamingStorageBuffer::beginWrite(size_t size)
+{
+    if (size > slotSize)
+        allocate(std::max(size, slotSize + slotSize / 2));
+    
+    slot = (slot + 1) % SLOTS;
+    waitFence(slot);
+    writeSize = size;
+    return persistent ? mapped + slot * slotSize : staging.data();
+}
+
+void StreamingStorageBuffer::endWrite()
+{
+    size_t offset = slot * slotSize;
+    if (!persistent && writeSize > 0)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, writeSize, staging.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, ID, offset, std::max<size_t>(writeSize, sizeof(float)));
+    written = true;
+}
+
+void StreamingStorageBuffer::fence()
+{
+    if (!written)
+        return;
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    written = false;
+}
+
+void StreamingStorageBuffer::allocate(size_t size)
+{
+    // Immutable storage cannot grow in place, so a larger ring is a new buffer
+    release();
+    slotSize = (size + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+    
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
+    if (persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, slotSize * SLOTS, NULL, flags);
+        mapped = static_cast<char*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, slotSize * SLOTS, flags));
+    }
+    else
+    {
+        glBufferData(GL_SHADER_STORAGE_BUFFER, slotSize * SLOTS, NULL, GL_STREAM_DRAW);
+        staging.resize(slotSize);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void StreamingStorageBuffer::release()
+{
+    for (int i = 0; i < SLOTS; i++)
+        waitFence(i);
+    if (ID == 0)
+        return;
+    
+    if (mapped)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        mapped = nullptr;
+    }
+    glDeleteBuffers(1, &ID);
+    ID = 0;
+}
+
+void StreamingStorageBuffer::waitFence(int index)
+{
+    GLsync sync = static_cast<GLsync>(fences[index]);
+    if (!sync)
+        return;
+    while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+    {
+    }
+    glDeleteSync(sync);
+    fences[index] = nullptr;
+}
+
+FeedbackMesh::FeedbackMesh(size_t maxVertices)
+{
+    glGenTransformFeedbacks(1, &feedback);
+    glGenBuffers(1, &buffer);
+    glGenVertexArrays(1, &VAO);
+    
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, maxVertices * 2 * sizeof(glm::vec3), NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)sizeof(glm::vec3));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+FeedbackMesh::~FeedbackMesh()
+{
+    glDeleteTransformFeedbacks(1, &feedback);
+    glDeleteBuffers(1, &buffer);
+    glDeleteVertexArrays(1, &VAO);
+}
+
+void FeedbackMesh::begin()
+{
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+    glBeginTransformFeedback(GL_TRIANGLES);
+}
+
+void FeedbackMesh::end()
+{
+    glEndTransformFeedback();
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+}
+
+void FeedbackMesh::draw() const
+{
+    glBindVertexArray(VAO);
+    glDrawTransformFeedback(GL_TRIANGLES, feedback);
+}
+
+FieldVolume::FieldVolume(int maxResolution) : size(maxResolution + 1)
+{
+    glGenTextures(1, &fieldTexture);
+    glBindTexture(GL_TEXTURE_3D, fieldTexture);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_R32F, size, size, size);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    
+    glGenTextures(1, &normalTexture);
+    glBindTexture(GL_TEXTURE_3D, normalTexture);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, size, size, size);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+FieldVolume::~FieldVolume()
+{
+    glDeleteTextures(1, &fieldTexture);
+    glDeleteTextures(1, &normalTexture);
+}
+
+void FieldVolume::compute(int resolution)
+{
+    glBindImageTexture(0, fieldTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+    glBindImageTexture(1, normalTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    GLuint groups = (std::min(resolution + 1, size) + FIELD_VOLUME_LOCAL_SIZE - 1) / FIELD_VOLUME_LOCAL_SIZE;
+    glDispatchCompute(groups, groups, groups);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, fieldTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, normalTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+namespace {
+    const int SCAN_BLOCK_SIZE = 512;   // local_size_x of mc_scan.comp and mc_scan_blocks.comp
+    const int CELL_GROUP_SIZE = 4;     // local_size_x/y/z of mc_classify.comp and mc_generate.comp
+    const int MAX_CELL_VERTICES = 15;  // five triangles
+}
+
+ComputeMesher::ComputeMesher(int maxResolution)
+    : classifyShader("shaders/mc_classify.comp"), scanShader("shaders/mc_scan.comp"),
+      scanBlocksShader("shaders/mc_scan_blocks.comp"), generateShader("shaders/mc_generate.comp"),
+      cellCounts(5), cellOffsets(6), blockSums(7), vertices(8), command(9)
+{
+    // Sized for the worst case of five triangles in every cell, so no cell's output is ever dropped
+    size_t cellCount = static_cast<size_t>(maxResolution) * maxResolution * maxResolution;
+    size_t blockCount = (cellCount + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+    cellCounts.reserve(cellCount * sizeof(unsigned int));
+    cellOffsets.reserve(cellCount * sizeof(unsigned int));
+    blockSums.reserve(blockCount * sizeof(unsigned int));
+    vertices.reserve(cellCount * MAX_CELL_VERTICES * 2 * sizeof(glm::vec4));
+    unsigned int emptyDraw[4] = { 0, 1, 0, 0 };
+    command.reserve(sizeof(emptyDraw));
+    command.write(0, emptyDraw, sizeof(emptyDraw));
+    
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, vertices.ID);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (void*)sizeof(glm::vec4));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+ComputeMesher::~ComputeMesher()
+{
+    glDeleteVertexArrays(1, &VAO);
+}
+
+void ComputeMesher::extract(int resolution)
+{
+    GLuint cellGroups = (resolution + CELL_GROUP_SIZE - 1) / CELL_GROUP_SIZE;
+    GLuint blockCount = (static_cast<GLuint>(resolution) * resolution * resolution + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+    
+    classifyShader.use();
+    glDispatchCompute(cellGroups, cellGroups, cellGroups);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    
+    scanShader.use();
+    glDispatchCompute(blockCount, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    
+    scanBlocksShader.use();
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    
+    generateShader.use();
+    glDispatchCompute(cellGroups, cellGroups, cellGroups);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void ComputeMesher::draw() const
+{
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command.ID);
+    glDrawArraysIndirect(GL_TRIANGLES, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+MeshBuffer::MeshBuffer() : indexCount(0)
+{
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &positionVBO);
+    glGenBuffers(1, &normalVBO);
+    glGenBuffers(1, &EBO);
+    
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, normalVBO);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+MeshBuffer::~MeshBuffer()
+{
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &positionVBO);
+    glDeleteBuffers(1, &normalVBO);
+    glDeleteBuffers(1, &EBO);
+}
+
+void MeshBuffer::upload(const Mesh& mesh)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(glm::vec3), mesh.vertices.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, normalVBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(glm::vec3), mesh.normals.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    // The element buffer binding is VAO state
+    glBindVertexArray(VAO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), mesh.indices.data(), GL_DYNAMIC_DRAW);
+    glBindVertexArray(0);
+    
+    indexCount = static_cast<int>(mesh.indices.size());
+}
+
+void MeshBuffer::draw() const
+{
+    if (indexCount == 0)
+        return;
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+}
+
+SphereSet::SphereSet(const std::vector<Sphere>& spheres)
+{
+    reserve(spheres.size());
+    for (const auto& sphere : spheres)
+        add(sphere);
+}
+
+void SphereSet::add(const Sphere& sphere)
+{
+    x.push_back(sphere.position.x);
+    y.push_back(sphere.position.y);
+    z.push_back(sphere.position.z);
+    radius.push_back(sphere.radius);
+    radiusSq.push_back(sphere.radius * sphere.radius);
+    vx.push_back(sphere.velocity.x);
+    vy.push_back(sphere.velocity.y);
+    vz.push_back(sphere.velocity.z);
+    color.push_back(sphere.color);
+    revision++;
+}
+
+void SphereSet::writeShaderData(float* out) const
+{
+    size_t count = size();
+    std::copy(x.begin(), x.end(), out);
+    std::copy(y.begin(), y.end(), out + count);
+    std::copy(z.begin(), z.end(), out + 2 * count);
+    std::copy(radiusSq.begin(), radiusSq.end(), out + 3 * count);
+}
+
+void SphereSet::setRadius(size_t index, float r)
+{
+    radius[index] = r;
+    radiusSq[index] = r * r;
+    revision++;
+}
+
+void SphereSet::reserve(size_t count)
+{
+    x.reserve(count);
+    y.reserve(count);
+    z.reserve(count);
+    radius.reserve(count);
+    radiusSq.reserve(count);
+    vx.reserve(count);
+    vy.reserve(count);
+    vz.reserve(count);
+    color.reserve(count);
+}
+
+void SphereSet::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    radius.clear();
+    radiusSq.clear();
+    vx.clear();
+    vy.clear();
+    vz.clear();
+    color.clear();
+    revision++;
+}
+
+Sphere SphereSet::get(size_t index) const
+{
+    Sphere sphere(glm::vec3(x[index], y[index], z[index]), radius[index], glm::vec3(vx[index], vy[index], vz[index]));
+    sphere.color = color[index];
+    return sphere;
+}
+
+void SphereSet::integrate(float deltaTime, float boundary)
+{
+    auto step = [deltaTime, boundary](AlignedVector<float>& position, AlignedVector<float>& velocity) {
+        for (size_t i = 0; i < position.size(); i++)
+        {
+            position[i] += velocity[i] * deltaTime;
+            if (position[i] > boundary || position[i] < -boundary)
+                velocity[i] *= -1;
+        }
+    };
+    step(x, vx);
+    step(y, vy);
+    step(z, vz);
+    if (deltaTime != 0.0f && !empty())
+        revision++;
+}
+
+void SphereHashGrid::build(const SphereSet& spheres, float supportScale, unsigned int threadCount)
+{
+    size_t count = spheres.size();
+    
+    float maxRadius = 0.0f;
+    for (float r : spheres.radius)
+        maxRadius = std::max(maxRadius, r);
+    cellSize = std::max(maxRadius * supportScale, 0.0001f);
+    
+    unsigned int tableSize = 1;
+    while (tableSize < 2 * count)
+        tableSize <<= 1;
+    tableMask = tableSize - 1;
+    
+    // Chunks of at least 4096 spheres, so small scenes are sorted on the calling thread
+    const size_t minChunk = 4096;
+    int chunks = static_cast<int>(std::max<size_t>(1, std::min<size_t>(Threading::workerCount(threadCount),
+                                                                       (count + minChunk - 1) / minChunk)));
+    auto chunkBegin = [&](int chunk) { return count * chunk / chunks; };
+    
+    std::vector<Entry> unsorted(count);
+    std::vector<unsigned int> keys(count);
+    std::vector<int> counts(static_cast<size_t>(chunks) * tableSize, 0);
+    
+    Threading::parallelFor(chunks, [&](int chunk) {
+        int* chunkCounts = &counts[static_cast<size_t>(chunk) * tableSize];
+        for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++)
+        {
+            float support = spheres.radius[i] * supportScale;
+            Entry entry{ static_cast<int>(i), cellCoord(spheres.x[i]), cellCoord(spheres.y[i]), cellCoord(spheres.z[i]),
+                         spheres.x[i], spheres.y[i], spheres.z[i], support * support };
+            unsorted[i] = entry;
+            keys[i] = bucket(entry.cx, entry.cy, entry.cz);
+            chunkCounts[keys[i]]++;
+        }
+    }, chunks);
+    
+    // Exclusive prefix sum; inside a bucket chunk 0 comes first, so the scatter keeps sphere order
+    bucketStart.assign(tableSize + 1, 0);
+    int running = 0;
+    for (unsigned int b = 0; b < tableSize; b++)
+    {
+        bucketStart[b] = running;
+        for (int chunk = 0; chunk < chunks; chunk++)
+        {
+            int& slot = counts[static_cast<size_t>(chunk) * tableSize + b];
+            int n = slot;
+            slot = running;
+            running += n;
+        }
+    }
+    bucketStart[tableSize] = running;
+    
+    entries.resize(count);
+    Threading::parallelFor(chunks, [&](int chunk) {
+        int* chunkOffsets = &counts[static_cast<size_t>(chunk) * tableSize];
+        for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++)
+            entries[chunkOffsets[keys[i]]++] = unsorted[i];
+    }, chunks);
+}
+
+void SphereHashGrid::gatherRow(float xMin, float xMax, float y, float z, std::vector<int>& out) const
+{
+    out.clear();
+    if (entries.empty())
+        return;
+    
+    int py = cellCoord(y), pz = cellCoord(z);
+    int xBegin = cellCoord(xMin) - 1, xEnd = cellCoord(xMax) + 1;
+    for (int cz = pz - 1; cz <= pz + 1; cz++)
+        for (int cy = py - 1; cy <= py + 1; cy++)
+            for (int cx = xBegin; cx <= xEnd; cx++)
+            {
+                unsigned int b = bucket(cx, cy, cz);
+                for (int e = bucketStart[b]; e < bucketStart[b + 1]; e++)
+                {
+                    const Entry& entry = entries[e];
+                    if (entry.cx != cx || entry.cy != cy || entry.cz != cz)
+                        continue;
+                    float dx = entry.x - std::min(std::max(entry.x, xMin), xMax);
+                    float dy = entry.y - y, dz = entry.z - z;
+                    if (dx * dx + dy * dy + dz * dz < entry.supportSq)
+                        out.push_back(entry.sphere);
+                }
+            }
+}
+
 namespace MarchingCubes {
     
     std::vector<glm::vec3> generateGridPoints(float gridSize, int resolution)
     {
-        std::vector<glm::vec3> points;
         float cellSize = gridSize / float(resolution);
         float halfGrid = gridSize * 0.5f;
+        size_t slabPoints = static_cast<size_t>(resolution) * resolution;
+        std::vector<glm::vec3> points(slabPoints * resolution);
         
-        for (int x = 0; x < resolution; x++)
-        {
+        // Point (x, y, z) sits at index (x * resolution + y) * resolution + z, so every x slab is filled
+        // independently
+        Threading::parallelFor(resolution, [&](int x) {
+            glm::vec3* point = points.data() + x * slabPoints;
             for (int y = 0; y < resolution; y++)
             {
                 for (int z = 0; z < resolution; z++)
                 {
-                    glm::vec3 point(
+                    *point++ = glm::vec3(
                         -halfGrid + x * cellSize,
                         -halfGrid + y * cellSize,
                         -halfGrid + z * cellSize
                     );
-                    points.push_back(point);
                 }
             }
-        }
+        });
         
         return points;
     }
@@ -271,16 +965,1792 @@ namespace MarchingCubes {
         return value;
     }
     
-    glm::vec3 calculateGradient(const glm::vec3& position, const std::vector<Sphere>& spheres, float epsilon)
-    {
-        glm::vec3 gradient;
-        gradient.x = calculateScalarField(position + glm::vec3(epsilon, 0, 0), spheres) - 
-                    calculateScalarField(position - glm::vec3(epsilon, 0, 0), spheres);
-        gradient.y = calculateScalarField(position + glm::vec3(0, epsilon, 0), spheres) - 
-                    calculateScalarField(position - glm::vec3(0, epsilon, 0), spheres);
-        gradient.z = calculateScalarField(position + glm::vec3(0, 0, epsilon), spheres) - 
-                    calculateScalarField(position - glm::vec3(0, 0, epsilon), spheres);
+    namespace {
+        // The scalar version compares dist > 0.0001 and then squares it again, so compare squared distances directly
+        const float MIN_DIST_SQ = 0.0001f * 0.0001f;
+        const float CENTER_VALUE = 1000.0f;
         
-        return glm::normalize(gradient);
-    }
-}
\ No newline at end of file
+        // Sphere arrays for the batched kernel; invSupportSq (1 / R^2 per sphere) is only read by Compact
+        struct KernelInput {
+            SphereSet::FieldView view;
+            const float* invSupportSq;
+        };
+        
+        // One batch of FIELD_BATCH_SIZE points
+        template <FieldKernel Kernel>
+        void fieldBatch(const float* xs, const float* ys, const float* zs, float* values, const KernelInput& input)
+        {
+            const SphereSet::FieldView& view = input.view;
+            size_t sphereCount = view.count;
+#if defined(__AVX__)
+            __m256 px = _mm256_loadu_ps(xs);
+            __m256 py = _mm256_loadu_ps(ys);
+            __m256 pz = _mm256_loadu_ps(zs);
+            __m256 sum = _mm256_setzero_ps();
+            __m256 nearCenter = _mm256_setzero_ps();
+            const __m256 minDistSq = _mm256_set1_ps(MIN_DIST_SQ);
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 zero = _mm256_setzero_ps();
+            
+            for (size_t s = 0; s < sphereCount; s++)
+            {
+                __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(view.x[s]));
+                __m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(view.y[s]));
+                __m256 dz = _mm256_sub_ps(pz, _mm256_set1_ps(view.z[s]));
+                __m256 distSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+                __m256 term = _mm256_div_ps(_mm256_set1_ps(view.radiusSq[s]), distSq);
+                if constexpr (Kernel == FieldKernel::Compact)
+                {
+                    __m256 falloff = _mm256_max_ps(_mm256_sub_ps(one, _mm256_mul_ps(distSq, _mm256_set1_ps(input.invSupportSq[s]))), zero);
+                    term = _mm256_mul_ps(term, _mm256_mul_ps(falloff, falloff));
+                }
+                sum = _mm256_add_ps(sum, term);
+                nearCenter = _mm256_or_ps(nearCenter, _mm256_cmp_ps(distSq, minDistSq, _CMP_LE_OQ));
+            }
+            
+            _mm256_storeu_ps(values, _mm256_blendv_ps(sum, _mm256_set1_ps(CENTER_VALUE), nearCenter));
+#elif defined(METABALLS_SSE2)
+            // Two 4-wide halves; SSE2 has no blendv, so select with and/andnot
+            for (int half = 0; half < FIELD_BATCH_SIZE; half += 4)
+            {
+                __m128 px = _mm_loadu_ps(xs + half);
+                __m128 py = _mm_loadu_ps(ys + half);
+                __m128 pz = _mm_loadu_ps(zs + half);
+                __m128 sum = _mm_setzero_ps();
+                __m128 nearCenter = _mm_setzero_ps();
+                const __m128 minDistSq = _mm_set1_ps(MIN_DIST_SQ);
+                const __m128 one = _mm_set1_ps(1.0f);
+                const __m128 zero = _mm_setzero_ps();
+                
+                for (size_t s = 0; s < sphereCount; s++)
+                {
+                    __m128 dx = _mm_sub_ps(px, _mm_set1_ps(view.x[s]));
+                    __m128 dy = _mm_sub_ps(py, _mm_set1_ps(view.y[s]));
+                    __m128 dz = _mm_sub_ps(pz, _mm_set1_ps(view.z[s]));
+                    __m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    __m128 term = _mm_div_ps(_mm_set1_ps(view.radiusSq[s]), distSq);
+                    if constexpr (Kernel == FieldKernel::Compact)
+                    {
+                        __m128 falloff = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(distSq, _mm_set1_ps(input.invSupportSq[s]))), zero);
+                        term = _mm_mul_ps(term, _mm_mul_ps(falloff, falloff));
+                    }
+                    sum = _mm_add_ps(sum, term);
+                    nearCenter = _mm_or_ps(nearCenter, _mm_cmple_ps(distSq, minDistSq));
+                }
+                
+                __m128 result = _mm_or_ps(_mm_and_ps(nearCenter, _mm_set1_ps(CENTER_VALUE)), _mm_andnot_ps(nearCenter, sum));
+                _mm_storeu_ps(values + half, result);
+            }
+#else
+            for (int n = 0; n < FIELD_BATCH_SIZE; n++)
+            {
+                float sum = 0.0f;
+                bool nearCenter = false;
+                for (size_t s = 0; s < sphereCount; s++)
+                {
+                    float dx = xs[n] - view.x[s];
+                    float dy = ys[n] - view.y[s];
+                    float dz = zs[n] - view.z[s];
+                    float distSq = dx * dx + dy * dy + dz * dz;
+                    float term = view.radiusSq[s] / distSq;
+                    if constexpr (Kernel == FieldKernel::Compact)
+                    {
+                        float falloff = std::max(1.0f - distSq * input.invSupportSq[s], 0.0f);
+                        term *= falloff * falloff;
+                    }
+                    sum += term;
+                    nearCenter = nearCenter || distSq <= MIN_DIST_SQ;
+                }
+                values[n] = nearCenter ? CENTER_VALUE : sum;
+            }
+#endif
+        }
+        
+        template <FieldKernel Kernel>
+        void fieldBatchRange(const float* xs, const float* ys, const float* zs, float* values, size_t count,
+                             const KernelInput& input)
+        {
+            size_t n = 0;
+            for (; n + FIELD_BATCH_SIZE <= count; n += FIELD_BATCH_SIZE)
+                fieldBatch<Kernel>(xs + n, ys + n, zs + n, values + n, input);
+            
+            if (n < count)
+            {
+                // Pad the tail with copies of its first point so every lane holds a finite position
+                float tailX[FIELD_BATCH_SIZE], tailY[FIELD_BATCH_SIZE], tailZ[FIELD_BATCH_SIZE], tailValues[FIELD_BATCH_SIZE];
+                for (int lane = 0; lane < FIELD_BATCH_SIZE; lane++)
+                {
+                    size_t src = n + lane < count ? n + lane : n;
+                    tailX[lane] = xs[src];
+                    tailY[lane] = ys[src];
+                    tailZ[lane] = zs[src];
+                }
+                fieldBatch<Kernel>(tailX, tailY, tailZ, tailValues, input);
+                std::copy(tailValues, tailValues + (count - n), values + n);
+            }
+        }
+        
+        void fieldBatchRange(const float* xs, const float* ys, const float* zs, float* values, size_t count,
+                             const KernelInput& input, FieldKernel kernel)
+        {
+            if (kernel == FieldKernel::Compact)
+                fieldBatchRange<FieldKernel::Compact>(xs, ys, zs, values, count, input);
+            else
+                fieldBatchRange<FieldKernel::InverseSquare>(xs, ys, zs, values, count, input);
+        }
+        
+        std::vector<float> inverseSupportSq(const SphereSet& spheres, const FieldParams& params)
+        {
+            std::vector<float> result(spheres.size());
+            float scaleSq = params.supportScale * params.supportScale;
+            for (size_t i = 0; i < spheres.size(); i++)
+                result[i] = 1.0f / (spheres.radiusSq[i] * scaleSq);
+            return result;
+        }
+    }
+    
+    float calculateScalarField(const glm::vec3& position, const SphereSet& spheres, const FieldParams& params,
+                               const SphereHashGrid* grid)
+    {
+        if (params.kernel == FieldKernel::InverseSquare)
+        {
+            float value = 0.0f;
+            
+            for (size_t i = 0; i < spheres.size(); i++)
+            {
+                float dx = position.x - spheres.x[i];
+                float dy = position.y - spheres.y[i];
+                float dz = position.z - spheres.z[i];
+                float distSq = dx * dx + dy * dy + dz * dz;
+                
+                if (distSq > MIN_DIST_SQ)
+                {
+                    value += spheres.radiusSq[i] / distSq;
+                }
+                else
+                {
+                    return CENTER_VALUE;
+                }
+            }
+            
+            return value;
+        }
+        
+        float value = 0.0f;
+        bool nearCenter = false;
+        float scaleSq = params.supportScale * params.supportScale;
+        auto accumulate = [&](size_t i) {
+            float dx = position.x - spheres.x[i];
+            float dy = position.y - spheres.y[i];
+            float dz = position.z - spheres.z[i];
+            float distSq = dx * dx + dy * dy + dz * dz;
+            float supportSq = spheres.radiusSq[i] * scaleSq;
+            if (distSq >= supportSq)
+                return;
+            if (distSq <= MIN_DIST_SQ)
+            {
+                nearCenter = true;
+                return;
+            }
+            float falloff = 1.0f - distSq / supportSq;
+            value += spheres.radiusSq[i] / distSq * falloff * falloff;
+        };
+        
+        if (grid)
+            grid->forEachNear(position, accumulate);
+        else
+            for (size_t i = 0; i < spheres.size(); i++)
+                accumulate(i);
+        
+        return nearCenter ? CENTER_VALUE : value;
+    }
+    
+    void calculateScalarFieldBatch(const float* xs, const float* ys, const float* zs, float* values, size_t count,
+                                   const SphereSet& spheres, const FieldParams& params)
+    {
+        std::vector<float> invSupportSq;
+        if (params.kernel == FieldKernel::Compact)
+            invSupportSq = inverseSupportSq(spheres, params);
+        fieldBatchRange(xs, ys, zs, values, count, { spheres.fieldView(), invSupportSq.data() }, params.kernel);
+    }
+    
+    glm::vec3 calculateGradient(const glm::vec3& position, const std::vector<Sphere>& spheres, float epsilon)
+    {
+        glm::vec3 gradient;
+        gradient.x = calculateScalarField(position + glm::vec3(epsilon, 0, 0), spheres) - 
+                    calculateScalarField(position - glm::vec3(epsilon, 0, 0), spheres);
+        gradient.y = calculateScalarField(position + glm::vec3(0, epsilon, 0), spheres) - 
+                    calculateScalarField(position - glm::vec3(0, epsilon, 0), spheres);
+        gradient.z = calculateScalarField(position + glm::vec3(0, 0, epsilon), spheres) - 
+                    calculateScalarField(position - glm::vec3(0, 0, epsilon), spheres);
+        
+        return glm::normalize(gradient);
+    }
+    
+    glm::vec3 calculateGradient(const glm::vec3& position, const SphereSet& spheres, float epsilon)
+    {
+        return calculateGradient(position, spheres, FieldParams(), nullptr, epsilon);
+    }
+    
+    glm::vec3 calculateGradient(const glm::vec3& position, const SphereSet& spheres, const FieldParams& params,
+                                const SphereHashGrid* grid, float epsilon)
+    {
+        auto field = [&](const glm::vec3& p) { return calculateScalarField(p, spheres, params, grid); };
+        
+        glm::vec3 gradient;
+        gradient.x = field(position + glm::vec3(epsilon, 0, 0)) - field(position - glm::vec3(epsilon, 0, 0));
+        gradient.y = field(position + glm::vec3(0, epsilon, 0)) - field(position - glm::vec3(0, epsilon, 0));
+        gradient.z = field(position + glm::vec3(0, 0, epsilon)) - field(position - glm::vec3(0, 0, epsilon));
+        
+        return glm::normalize(gradient);
+    }
+    
+    glm::vec4 calculateFieldAndGradient(const glm::vec3& position, const SphereSet& spheres, const FieldParams& params,
+                                        const SphereHashGrid* grid)
+    {
+        // With u = d^2: InverseSquare g(u) = r^2 / u, Compact g(u) = r^2 / u * (1 - u / R^2)^2,
+        // and grad g = g'(u) * 2 (p - c)
+        float value = 0.0f;
+        glm::vec3 gradient(0.0f);
+        bool nearCenter = false;
+        bool compact = params.kernel == FieldKernel::Compact;
+        float scaleSq = params.supportScale * params.supportScale;
+        
+        auto accumulate = [&](size_t i) {
+            glm::vec3 diff(position.x - spheres.x[i], position.y - spheres.y[i], position.z - spheres.z[i]);
+            float distSq = glm::dot(diff, diff);
+            float radiusSq = spheres.radiusSq[i];
+            float supportSq = radiusSq * scaleSq;
+            if (compact && distSq >= supportSq)
+                return;
+            if (distSq <= MIN_DIST_SQ)
+            {
+                nearCenter = true;
+                return;
+            }
+            
+            float inverse = 1.0f / distSq;
+            if (!compact)
+            {
+                value += radiusSq * inverse;
+                gradient += (-2.0f * radiusSq * inverse * inverse) * diff;
+                return;
+            }
+            
+            float falloff = 1.0f - distSq / supportSq;
+            value += radiusSq * inverse * falloff * falloff;
+            float derivative = -radiusSq * falloff * (falloff * inverse * inverse + 2.0f * inverse / supportSq);
+            gradient += (2.0f * derivative) * diff;
+        };
+        
+        if (compact && grid)
+            grid->forEachNear(position, accumulate);
+        else
+            for (size_t i = 0; i < spheres.size(); i++)
+                accumulate(i);
+        
+        if (nearCenter)
+            return glm::vec4(0.0f, 0.0f, 0.0f, CENTER_VALUE);
+        return glm::vec4(gradient, value);
+    }
+    
+    glm::vec3 calculateAnalyticGradient(const glm::vec3& position, const SphereSet& spheres, const FieldParams& params,
+                                        const SphereHashGrid* grid)
+    {
+        glm::vec3 gradient(calculateFieldAndGradient(position, spheres, params, grid));
+        float length = glm::length(gradient);
+        return length > 0.0f ? gradient / length : gradient;
+    }
+    
+    namespace {
+        // Cube corners and edges in the same order as the geometry shader
+        const int cubeVertices[8][3] = {
+            {0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+            {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+        };
+        
+        const int edgeVertices[12][2] = {
+            {0, 1}, {1, 2}, {2, 3}, {3, 0},
+            {4, 5}, {5, 6}, {6, 7}, {7, 4},
+            {0, 4}, {1, 5}, {2, 6}, {3, 7}
+        };
+        
+        glm::vec3 interpolateVertex(const glm::vec3& v1, const glm::vec3& v2, float val1, float val2, float isoLevel)
+        {
+            if (std::abs(isoLevel - val1) < 0.00001f)
+                return v1;
+            if (std::abs(isoLevel - val2) < 0.00001f)
+                return v2;
+            if (std::abs(val1 - val2) < 0.00001f)
+                return v1;
+            
+            float mu = (isoLevel - val1) / (val2 - val1);
+            return v1 + mu * (v2 - v1);
+        }
+        
+        // Field setup shared by all slabs of one extraction
+        struct FieldContext {
+            const SphereSet& spheres;
+            FieldParams params;
+            const SphereHashGrid* grid;       // Compact only
+            std::vector<float> invSupportSq;  // Compact only
+        };
+        
+        // Cells of one slab that may contain the surface, as a span [rowBegin, rowEnd) per cell row
+        struct ActiveCells {
+            int cellsX, cellsY, kBegin;
+            std::vector<unsigned char> cells;  // region-local x/y, slab-local z
+            std::vector<int> rowBegin, rowEnd;
+            
+            ActiveCells(int cellsX, int cellsY, int kBegin, int kEnd)
+                : cellsX(cellsX), cellsY(cellsY), kBegin(kBegin),
+                  cells(static_cast<size_t>(cellsX) * cellsY * (kEnd - kBegin), 0),
+                  rowBegin(static_cast<size_t>(cellsY) * (kEnd - kBegin), cellsX),
+                  rowEnd(static_cast<size_t>(cellsY) * (kEnd - kBegin), 0) {}
+            
+            int layers() const { return static_cast<int>(rowBegin.size()) / cellsY; }
+            size_t row(int j, int k) const { return static_cast<size_t>(k - kBegin) * cellsY + j; }
+            bool at(int i, int j, int k) const { return cells[row(j, k) * cellsX + i] != 0; }
+            
+            void mark(int i, int j, int k)
+            {
+                size_t r = row(j, k);
+                cells[r * cellsX + i] = 1;
+                rowBegin[r] = std::min(rowBegin[r], i);
+                rowEnd[r] = std::max(rowEnd[r], i + 1);
+            }
+            
+            // Lattice points of row j on plane k that some active cell uses, as [first, last]
+            bool pointSpan(int j, int k, int& first, int& last) const
+            {
+                first = cellsX + 1;
+                last = -1;
+                for (int kk = k - 1; kk <= k; kk++)
+                {
+                    if (kk < kBegin || kk >= kBegin + layers())
+                        continue;
+                    for (int jj = j - 1; jj <= j; jj++)
+                    {
+                        if (jj < 0 || jj >= cellsY)
+                            continue;
+                        size_t r = row(jj, kk);
+                        if (rowBegin[r] < rowEnd[r])
+                        {
+                            first = std::min(first, rowBegin[r]);
+                            last = std::max(last, rowEnd[r]);
+                        }
+                    }
+                }
+                return first <= last;
+            }
+        };
+        
+        // Relative slack on the field bounds, far above the rounding difference to the sampled values
+        const float BOUND_SLACK = 1e-4f;
+        const int OCTREE_LEAF_CELLS = 2;
+        
+        // Every kernel falls off monotonically with distance, so summing each sphere's value at the nearest and
+        // farthest point of a box brackets the field anywhere inside it. reaching gets the spheres with a nonzero
+        // contribution, which is all the box's children need to look at.
+        bool mayContainSurface(const glm::vec3& boxMin, const glm::vec3& boxMax, const std::vector<int>& spheres,
+                               std::vector<int>& reaching, const FieldContext& field, float isoLevel)
+        {
+            bool compact = field.params.kernel == FieldKernel::Compact;
+            float low = 0.0f;
+            float high = 0.0f;
+            bool nearCenter = false;
+            reaching.clear();
+            
+            for (int s : spheres)
+            {
+                glm::vec3 center(field.spheres.x[s], field.spheres.y[s], field.spheres.z[s]);
+                glm::vec3 nearest = center - glm::clamp(center, boxMin, boxMax);
+                glm::vec3 farthest = glm::max(center - boxMin, boxMax - center);
+                float nearSq = glm::dot(nearest, nearest);
+                float farSq = glm::dot(farthest, farthest);
+                float radiusSq = field.spheres.radiusSq[s];
+                
+                float nearFalloff = 1.0f;
+                float farFalloff = 1.0f;
+                if (compact)
+                {
+                    float invSupportSq = field.invSupportSq[s];
+                    if (nearSq * invSupportSq >= 1.0f)
+                        continue;
+                    nearFalloff = 1.0f - nearSq * invSupportSq;
+                    farFalloff = std::max(1.0f - farSq * invSupportSq, 0.0f);
+                }
+                reaching.push_back(s);
+                
+                if (nearSq <= MIN_DIST_SQ)
+                    nearCenter = true;
+                else
+                    high += radiusSq / nearSq * nearFalloff * nearFalloff;
+                low += radiusSq / farSq * farFalloff * farFalloff;
+            }
+            
+            // Samples this close to a centre read CENTER_VALUE instead of the sum
+            if (nearCenter)
+                return low * (1.0f - BOUND_SLACK) < isoLevel || CENTER_VALUE < isoLevel;
+            return high * (1.0f + BOUND_SLACK) >= isoLevel && low * (1.0f - BOUND_SLACK) < isoLevel;
+        }
+        
+        // Octree descent over global cells [lo, hi), halving every axis longer than a leaf
+        void markActiveCells(ActiveCells& active, const glm::ivec3& lo, const glm::ivec3& hi, const std::vector<int>& spheres,
+                             const FieldContext& field, const GridRegion& region, float isoLevel)
+        {
+            std::vector<int> reaching;
+            if (!mayContainSurface(region.latticePoint(lo.x, lo.y, lo.z), region.latticePoint(hi.x, hi.y, hi.z),
+                                   spheres, reaching, field, isoLevel))
+                return;
+            
+            glm::ivec3 extent = hi - lo;
+            if (glm::all(glm::lessThanEqual(extent, glm::ivec3(OCTREE_LEAF_CELLS))))
+            {
+                for (int k = lo.z; k < hi.z; k++)
+                    for (int j = lo.y; j < hi.y; j++)
+                        for (int i = lo.x; i < hi.x; i++)
+                            active.mark(i - region.begin.x, j - region.begin.y, k);
+                return;
+            }
+            
+            glm::ivec3 mid = glm::mix(hi, lo + extent / 2, glm::greaterThan(extent, glm::ivec3(OCTREE_LEAF_CELLS)));
+            for (int child = 0; child < 8; child++)
+            {
+                glm::ivec3 childLo((child & 1) ? mid.x : lo.x, (child & 2) ? mid.y : lo.y, (child & 4) ? mid.z : lo.z);
+                glm::ivec3 childHi((child & 1) ? hi.x : mid.x, (child & 2) ? hi.y : mid.y, (child & 4) ? hi.z : mid.z);
+                if (glm::all(glm::lessThan(childLo, childHi)))
+                    markActiveCells(active, childLo, childHi, reaching, field, region, isoLevel);
+            }
+        }
+        
+        void findActiveCells(ActiveCells& active, int kBegin, int kEnd, const FieldContext& field, const GridRegion& region,
+                             float isoLevel)
+        {
+            std::vector<int> allSpheres(field.spheres.size());
+            for (size_t s = 0; s < allSpheres.size(); s++)
+                allSpheres[s] = static_cast<int>(s);
+            markActiveCells(active, glm::ivec3(region.begin.x, region.begin.y, kBegin),
+                            glm::ivec3(region.end.x, region.end.y, kEnd), allSpheres, field, region, isoLevel);
+        }
+        
+        // Samples one z-plane of a region's lattice, one batched row at a time
+        struct PlaneSampler {
+            const GridRegion& region;
+            int pointsX, pointsY;
+            const FieldContext& field;
+            std::vector<float> xs, ys, zs;
+            
+            // Spheres reaching the current row when the hash grid is used
+            std::vector<int> candidates;
+            AlignedVector<float> nearX, nearY, nearZ, nearRadiusSq, nearInvSupportSq;
+            
+            PlaneSampler(const GridRegion& region, const FieldContext& field)
+                : region(region), pointsX(region.end.x - region.begin.x + 1), pointsY(region.end.y - region.begin.y + 1),
+                  field(field), xs(pointsX), ys(pointsX), zs(pointsX)
+            {
+                for (int i = 0; i < pointsX; i++)
+                    xs[i] = region.latticePoint(region.begin.x + i, 0, 0).x;
+            }
+            
+            KernelInput rowInput(float y, float z)
+            {
+                if (!field.grid)
+                    return { field.spheres.fieldView(), field.invSupportSq.data() };
+                
+                field.grid->gatherRow(xs.front(), xs.back(), y, z, candidates);
+                nearX.clear();
+                nearY.clear();
+                nearZ.clear();
+                nearRadiusSq.clear();
+                nearInvSupportSq.clear();
+                for (int index : candidates)
+                {
+                    nearX.push_back(field.spheres.x[index]);
+                    nearY.push_back(field.spheres.y[index]);
+                    nearZ.push_back(field.spheres.z[index]);
+                    nearRadiusSq.push_back(field.spheres.radiusSq[index]);
+                    nearInvSupportSq.push_back(field.invSupportSq[index]);
+                }
+                return { { nearX.data(), nearY.data(), nearZ.data(), nearRadiusSq.data(), candidates.size() },
+                         nearInvSupportSq.data() };
+            }
+            
+            // k is a lattice index in [region.begin.z, region.end.z]. With active cells only the points those
+            // cells read are sampled; the rest of the plane keeps stale values nobody looks at.
+            void sample(std::vector<float>& plane, int k, const ActiveCells* active)
+            {
+                float z = region.latticePoint(0, 0, k).z;
+                std::fill(zs.begin(), zs.end(), z);
+                for (int j = 0; j < pointsY; j++)
+                {
+                    int first = 0;
+                    int last = pointsX - 1;
+                    if (active && !active->pointSpan(j, k, first, last))
+                        continue;
+                    
+                    float y = region.latticePoint(0, region.begin.y + j, 0).y;
+                    std::fill(ys.begin(), ys.end(), y);
+                    fieldBatchRange(xs.data() + first, ys.data(), zs.data(), &plane[static_cast<size_t>(j) * pointsX + first],
+                                    last - first + 1, rowInput(y, z), field.params.kernel);
+                }
+            }
+        };
+        
+        // Edge -> axis (0 = x, 1 = y, 2 = z) and lattice offset of its lower corner inside the cell
+        const int edgeLattice[12][4] = {
+            {0, 0, 0, 0}, {1, 1, 0, 0}, {0, 0, 1, 0}, {1, 0, 0, 0},
+            {0, 0, 0, 1}, {1, 1, 0, 1}, {0, 0, 1, 1}, {1, 0, 0, 1},
+            {2, 0, 0, 0}, {2, 1, 0, 0}, {2, 1, 1, 0}, {2, 0, 1, 0}
+        };
+        
+        const unsigned int NO_VERTEX = 0xFFFFFFFFu;
+        // Set on slab indices that point at an x/y edge of the slab's top plane, which the next slab owns
+        const unsigned int EXTERNAL_VERTEX = 0x80000000u;
+        // z layers per slab of extractMesh
+        const int SLAB_CELLS = 4;
+        
+        struct SlabMesh {
+            Mesh mesh;
+            std::vector<unsigned int> bottomEdges;  // x/y edge slot -> local vertex on plane kBegin
+        };
+        
+        // Polygonises region cells with lattice z in [kBegin, kEnd). Every lattice edge gets one vertex:
+        // x/y edges are cached per plane (lower/upper), z edges for the current layer only.
+        void extractSlab(SlabMesh& out, int kBegin, int kEnd, bool ownsTopPlane, const FieldContext& field,
+                         const GridRegion& region, float isoLevel, bool skipEmptySpace)
+        {
+            Mesh& mesh = out.mesh;
+            int cellsX = region.end.x - region.begin.x;
+            int cellsY = region.end.y - region.begin.y;
+            int pointsX = cellsX + 1;
+            size_t planeSize = static_cast<size_t>(pointsX) * (cellsY + 1);
+            
+            // A cell whose edge carries a vertex always straddles isoLevel, so every cell sharing that edge is
+            // active too and welding across cells and slabs still sees each vertex
+            ActiveCells active(cellsX, cellsY, kBegin, kEnd);
+            const ActiveCells* activeCells = nullptr;
+            if (skipEmptySpace)
+            {
+                findActiveCells(active, kBegin, kEnd, field, region, isoLevel);
+                activeCells = &active;
+            }
+            
+            PlaneSampler sampler(region, field);
+            std::vector<float> lower(planeSize);
+            std::vector<float> upper(planeSize);
+            sampler.sample(lower, kBegin, activeCells);
+            
+            std::vector<unsigned int> lowerEdges(2 * planeSize, NO_VERTEX);
+            std::vector<unsigned int> upperEdges(2 * planeSize, NO_VERTEX);
+            std::vector<unsigned int> zEdges(planeSize, NO_VERTEX);
+            
+            for (int k = kBegin; k < kEnd; k++)
+            {
+                sampler.sample(upper, k + 1, activeCells);
+                const std::vector<float>* planes[2] = { &lower, &upper };
+                std::vector<unsigned int>* planeEdges[2] = { &lowerEdges, &upperEdges };
+                bool topIsExternal = k + 1 == kEnd && !ownsTopPlane;
+                
+                for (int j = 0; j < cellsY; j++)
+                {
+                    int iBegin = activeCells ? active.rowBegin[active.row(j, k)] : 0;
+                    int iEnd = activeCells ? active.rowEnd[active.row(j, k)] : cellsX;
+                    for (int i = iBegin; i < iEnd; i++)
+                    {
+                        if (activeCells && !active.at(i, j, k))
+                            continue;
+                        
+                        float cubeValues[8];
+                        glm::vec3 worldVertices[8];
+                        int cubeIndex = 0;
+                        for (int c = 0; c < 8; c++)
+                        {
+                            int ci = i + cubeVertices[c][0];
+                            int cj = j + cubeVertices[c][1];
+                            int ck = cubeVertices[c][2];
+                            cubeValues[c] = (*planes[ck])[static_cast<size_t>(cj) * pointsX + ci];
+                            worldVertices[c] = region.latticePoint(region.begin.x + ci, region.begin.y + cj, k + ck);
+                            if (cubeValues[c] < isoLevel)
+                                cubeIndex |= (1 << c);
+                        }
+                        
+                        if (edgeTable[cubeIndex] == 0)
+                            continue;
+                        
+                        unsigned int edgeVertexIndex[12];
+                        for (int e = 0; e < 12; e++)
+                        {
+                            if ((edgeTable[cubeIndex] & (1 << e)) == 0)
+                                continue;
+                            
+                            int axis = edgeLattice[e][0];
+                            size_t point = static_cast<size_t>(j + edgeLattice[e][2]) * pointsX + (i + edgeLattice[e][1]);
+                            int plane = edgeLattice[e][3];
+                            unsigned int& slot = axis == 2 ? zEdges[point] : (*planeEdges[plane])[axis * planeSize + point];
+                            
+                            if (slot == NO_VERTEX)
+                            {
+                                if (axis != 2 && plane == 1 && topIsExternal)
+                                {
+                                    slot = EXTERNAL_VERTEX | static_cast<unsigned int>(axis * planeSize + point);
+                                }
+                                else
+                                {
+                                    // Always interpolate from the lower corner so the vertex does not depend on
+                                    // which of the (up to four) cells sharing the edge created it
+                                    int v1 = edgeVertices[e][0];
+                                    int v2 = edgeVertices[e][1];
+                                    if (cubeVertices[v1][axis] > cubeVertices[v2][axis])
+                                        std::swap(v1, v2);
+                                    glm::vec3 vertexPos = interpolateVertex(worldVertices[v1], worldVertices[v2],
+                                                                            cubeValues[v1], cubeValues[v2], isoLevel);
+                                    slot = static_cast<unsigned int>(mesh.vertices.size());
+                                    mesh.vertices.push_back(vertexPos);
+                                    mesh.normals.push_back(calculateAnalyticGradient(vertexPos, field.spheres, field.params, field.grid));
+                                }
+                            }
+                            edgeVertexIndex[e] = slot;
+                        }
+                        
+                        for (int t = 0; triTable[cubeIndex][t] != -1; t++)
+                            mesh.indices.push_back(edgeVertexIndex[triTable[cubeIndex][t]]);
+                    }
+                }
+                
+                // The bottom plane is complete once its only layer of cells is done
+                if (k == kBegin && k > region.begin.z)
+                    out.bottomEdges = lowerEdges;
+                
+                std::swap(lower, upper);
+                std::swap(lowerEdges, upperEdges);
+                std::fill(upperEdges.begin(), upperEdges.end(), NO_VERTEX);
+                std::fill(zEdges.begin(), zEdges.end(), NO_VERTEX);
+            }
+        }
+    }
+    
+    namespace {
+        // Naive surface nets: each cell with a sign change gets one vertex at the mean of its edge crossings,
+        // and each crossed lattice edge joins the four cells around it with a quad. Cell (i, j, k) owns the
+        // three edges leaving its lowest corner; their other cells lie at lower indices and exist already.
+        // Halo cells are polygonised like the rest but own no edges.
+        Mesh extractSurfaceNets(const FieldContext& field, const GridRegion& owned, float isoLevel, bool skipEmptySpace)
+        {
+            GridRegion region = owned;
+            region.begin -= owned.halo;
+            region.halo = glm::ivec3(0);
+            
+            Mesh mesh;
+            int cellsX = region.end.x - region.begin.x;
+            int cellsY = region.end.y - region.begin.y;
+            int pointsX = cellsX + 1;
+            size_t planeSize = static_cast<size_t>(pointsX) * (cellsY + 1);
+            size_t layerSize = static_cast<size_t>(cellsX) * cellsY;
+            
+            ActiveCells active(cellsX, cellsY, region.begin.z, region.end.z);
+            const ActiveCells* activeCells = nullptr;
+            if (skipEmptySpace)
+            {
+                findActiveCells(active, region.begin.z, region.end.z, field, region, isoLevel);
+                activeCells = &active;
+            }
+            
+            PlaneSampler sampler(region, field);
+            std::vector<float> lower(planeSize);
+            std::vector<float> upper(planeSize);
+            sampler.sample(lower, region.begin.z, activeCells);
+            
+            std::vector<unsigned int> lowerCells(layerSize, NO_VERTEX);
+            std::vector<unsigned int> upperCells(layerSize, NO_VERTEX);
+            
+            // Quad a-b-c-d faces +axis; flipped when the far end of the edge is inside
+            auto emitQuad = [&](unsigned int a, unsigned int b, unsigned int c, unsigned int d, bool farInside) {
+                if (a == NO_VERTEX || b == NO_VERTEX || c == NO_VERTEX || d == NO_VERTEX)
+                    return;
+                if (farInside)
+                    std::swap(b, d);
+                // Split along the shorter diagonal
+                glm::vec3 ac = mesh.vertices[c] - mesh.vertices[a];
+                glm::vec3 bd = mesh.vertices[d] - mesh.vertices[b];
+                if (glm::dot(ac, ac) <= glm::dot(bd, bd))
+                    mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+                else
+                    mesh.indices.insert(mesh.indices.end(), { a, b, d, b, c, d });
+            };
+            
+            for (int k = region.begin.z; k < region.end.z; k++)
+            {
+                sampler.sample(upper, k + 1, activeCells);
+                const std::vector<float>* planes[2] = { &lower, &upper };
+                
+                for (int j = 0; j < cellsY; j++)
+                {
+                    int iBegin = activeCells ? active.rowBegin[active.row(j, k)] : 0;
+                    int iEnd = activeCells ? active.rowEnd[active.row(j, k)] : cellsX;
+                    for (int i = iBegin; i < iEnd; i++)
+                    {
+                        if (activeCells && !active.at(i, j, k))
+                            continue;
+                        
+                        float cubeValues[8];
+                        glm::vec3 worldVertices[8];
+                        int cubeIndex = 0;
+                        for (int c = 0; c < 8; c++)
+                        {
+                            int ci = i + cubeVertices[c][0];
+                            int cj = j + cubeVertices[c][1];
+                            int ck = cubeVertices[c][2];
+                            cubeValues[c] = (*planes[ck])[static_cast<size_t>(cj) * pointsX + ci];
+                            worldVertices[c] = region.latticePoint(region.begin.x + ci, region.begin.y + cj, k + ck);
+                            if (cubeValues[c] < isoLevel)
+                                cubeIndex |= (1 << c);
+                        }
+                        
+                        if (edgeTable[cubeIndex] == 0)
+                            continue;
+                        
+                        glm::vec3 vertexPos(0.0f);
+                        int crossings = 0;
+                        for (int e = 0; e < 12; e++)
+                        {
+                            if ((edgeTable[cubeIndex] & (1 << e)) == 0)
+                                continue;
+                            int v1 = edgeVertices[e][0];
+                            int v2 = edgeVertices[e][1];
+                            if (cubeVertices[v1][edgeLattice[e][0]] > cubeVertices[v2][edgeLattice[e][0]])
+                                std::swap(v1, v2);
+                            vertexPos += interpolateVertex(worldVertices[v1], worldVertices[v2], cubeValues[v1], cubeValues[v2], isoLevel);
+                            crossings++;
+                        }
+                        vertexPos /= float(crossings);
+                        
+                        upperCells[static_cast<size_t>(j) * cellsX + i] = static_cast<unsigned int>(mesh.vertices.size());
+                        mesh.vertices.push_back(vertexPos);
+                        mesh.normals.push_back(calculateAnalyticGradient(vertexPos, field.spheres, field.params, field.grid));
+                    }
+                }
+                
+                // Edges leaving the lowest corner (i, j, k) of each cell of this layer
+                for (int j = 0; j < cellsY; j++)
+                {
+                    for (int i = 0; i < cellsX; i++)
+                    {
+                        size_t cell = static_cast<size_t>(j) * cellsX + i;
+                        if (upperCells[cell] == NO_VERTEX || i < owned.halo.x || j < owned.halo.y || k < owned.begin.z)
+                            continue;
+                        
+                        float corner = lower[static_cast<size_t>(j) * pointsX + i];
+                        bool cornerInside = corner >= isoLevel;
+                        auto at = [&](const std::vector<unsigned int>& layer, int ci, int cj) { return layer[static_cast<size_t>(cj) * cellsX + ci]; };
+                        
+                        float xEnd = lower[static_cast<size_t>(j) * pointsX + i + 1];
+                        if (j > 0 && k > region.begin.z && (xEnd >= isoLevel) != cornerInside)
+                            emitQuad(at(lowerCells, i, j - 1), at(lowerCells, i, j), at(upperCells, i, j), at(upperCells, i, j - 1), xEnd >= isoLevel);
+                        
+                        float yEnd = lower[static_cast<size_t>(j + 1) * pointsX + i];
+                        if (i > 0 && k > region.begin.z && (yEnd >= isoLevel) != cornerInside)
+                            emitQuad(at(lowerCells, i - 1, j), at(upperCells, i - 1, j), at(upperCells, i, j), at(lowerCells, i, j), yEnd >= isoLevel);
+                        
+                        float zEnd = upper[static_cast<size_t>(j) * pointsX + i];
+                        if (i > 0 && j > 0 && (zEnd >= isoLevel) != cornerInside)
+                            emitQuad(at(upperCells, i - 1, j - 1), at(upperCells, i, j - 1), at(upperCells, i, j), at(upperCells, i - 1, j), zEnd >= isoLevel);
+                    }
+                }
+                
+                std::swap(lower, upper);
+                std::swap(lowerCells, upperCells);
+                std::fill(upperCells.begin(), upperCells.end(), NO_VERTEX);
+            }
+            
+            return mesh;
+        }
+    }
+    
+    GridRegion GridRegion::cube(float gridSize, int resolution)
+    {
+        return { glm::vec3(-gridSize * 0.5f), gridSize / float(resolution), glm::ivec3(0), glm::ivec3(resolution) };
+    }
+    
+    Mesh extractMesh(const SphereSet& spheres, float gridSize, int resolution, float isoLevel, const MeshSettings& settings)
+    {
+        if (resolution <= 0)
+            return Mesh();
+        return extractMesh(spheres, GridRegion::cube(gridSize, resolution), isoLevel, settings);
+    }
+    
+    Mesh extractMesh(const SphereSet& spheres, const GridRegion& region, float isoLevel, const MeshSettings& settings,
+                     const SphereHashGrid* grid)
+    {
+        Mesh mesh;
+        int cellsZ = region.end.z - region.begin.z;
+        if (region.end.x <= region.begin.x || region.end.y <= region.begin.y || cellsZ <= 0)
+            return mesh;
+        
+        unsigned int workers = Threading::workerCount(settings.threadCount);
+        
+        FieldContext field{ spheres, settings.field, nullptr, {} };
+        SphereHashGrid ownGrid;
+        if (settings.field.kernel == FieldKernel::Compact)
+        {
+            if (!grid)
+            {
+                ownGrid.build(spheres, settings.field.supportScale, workers);
+                grid = &ownGrid;
+            }
+            field.grid = grid;
+            field.invSupportSq = inverseSupportSq(spheres, settings.field);
+        }
+        
+        if (settings.extractor == Extractor::SurfaceNets)
+            return extractSurfaceNets(field, region, isoLevel, settings.skipEmptySpace);
+        
+        // Slabs of a fixed thickness, so the vertex and index order does not depend on the thread count;
+        // there are still several per worker at larger grids, so stealing can even out the surface density
+        int slabCount = (cellsZ + SLAB_CELLS - 1) / SLAB_CELLS;
+        std::vector<SlabMesh> slabs(slabCount);
+        
+        Threading::parallelFor(slabCount, [&](int slab) {
+            int kBegin = region.begin.z + static_cast<int>(static_cast<long long>(cellsZ) * slab / slabCount);
+            int kEnd = region.begin.z + static_cast<int>(static_cast<long long>(cellsZ) * (slab + 1) / slabCount);
+            extractSlab(slabs[slab], kBegin, kEnd, slab == slabCount - 1, field, region, isoLevel, settings.skipEmptySpace);
+        }, workers);
+        
+        // Stitch: place slabs one after another and resolve references into the next slab's bottom plane
+        std::vector<size_t> vertexOffset(slabCount + 1, 0), indexOffset(slabCount + 1, 0);
+        for (int slab = 0; slab < slabCount; slab++)
+        {
+            vertexOffset[slab + 1] = vertexOffset[slab] + slabs[slab].mesh.vertices.size();
+            indexOffset[slab + 1] = indexOffset[slab] + slabs[slab].mesh.indices.size();
+        }
+        mesh.vertices.resize(vertexOffset[slabCount]);
+        mesh.normals.resize(vertexOffset[slabCount]);
+        mesh.indices.resize(indexOffset[slabCount]);
+        
+        Threading::parallelFor(slabCount, [&](int slab) {
+            const Mesh& local = slabs[slab].mesh;
+            std::copy(local.vertices.begin(), local.vertices.end(), mesh.vertices.begin() + vertexOffset[slab]);
+            std::copy(local.normals.begin(), local.normals.end(), mesh.normals.begin() + vertexOffset[slab]);
+            
+            unsigned int offset = static_cast<unsigned int>(vertexOffset[slab]);
+            unsigned int* indices = &mesh.indices[indexOffset[slab]];
+            for (size_t n = 0; n < local.indices.size(); n++)
+            {
+                unsigned int index = local.indices[n];
+                if (index & EXTERNAL_VERTEX)
+                {
+                    const SlabMesh& next = slabs[slab + 1];
+                    indices[n] = next.bottomEdges[index & ~EXTERNAL_VERTEX] + static_cast<unsigned int>(vertexOffset[slab + 1]);
+                }
+                else
+                {
+                    indices[n] = index + offset;
+                }
+            }
+        }, workers);
+        
+        return mesh;
+    }
+    
+    void buildBrickSphereLists(const SphereSet& spheres, const GridRegion& region, int brickCells,
+                               const FieldParams& params, BrickSphereLists& lists)
+    {
+        brickCells = std::max(brickCells, 1);
+        lists.brickCells = brickCells;
+        lists.bricks = glm::max((region.end - region.begin + brickCells - 1) / brickCells, glm::ivec3(0));
+        int brickCount = lists.bricks.x * lists.bricks.y * lists.bricks.z;
+        lists.brickStart.assign(brickCount + 1, 0);
+        lists.sphereIndices.clear();
+        lists.activeBricks.clear();
+        if (brickCount == 0)
+            return;
+        
+        // Brick range of every sphere's support box, clamped to the region (empty when it lies outside)
+        bool compact = params.kernel == FieldKernel::Compact;
+        glm::vec3 regionMin = region.boundsMin();
+        glm::vec3 regionMax = region.boundsMax();
+        float brickSize = brickCells * region.cellSize;
+        size_t count = spheres.size();
+        std::vector<glm::ivec3> first(count, glm::ivec3(0)), last(count, lists.bricks - 1);
+        for (size_t i = 0; i < count && compact; i++)
+        {
+            glm::vec3 center(spheres.x[i], spheres.y[i], spheres.z[i]);
+            float reach = spheres.radius[i] * params.supportScale;
+            glm::vec3 low = center - reach, high = center + reach;
+            if (glm::any(glm::greaterThan(low, regionMax)) || glm::any(glm::lessThan(high, regionMin)))
+            {
+                last[i] = glm::ivec3(-1);
+                continue;
+            }
+            first[i] = glm::clamp(glm::ivec3(glm::floor((low - regionMin) / brickSize)), glm::ivec3(0), lists.bricks - 1);
+            last[i] = glm::clamp(glm::ivec3(glm::floor((high - regionMin) / brickSize)), glm::ivec3(0), lists.bricks - 1);
+        }
+        
+        // Counting sort: sizes, prefix sums, then a second pass placing the indices
+        auto forEachBrick = [&](size_t i, auto&& visit) {
+            for (int z = first[i].z; z <= last[i].z; z++)
+                for (int y = first[i].y; y <= last[i].y; y++)
+                    for (int x = first[i].x; x <= last[i].x; x++)
+                        visit((z * lists.bricks.y + y) * lists.bricks.x + x);
+        };
+        for (size_t i = 0; i < count; i++)
+            forEachBrick(i, [&](int b) { lists.brickStart[b + 1]++; });
+        for (int b = 0; b < brickCount; b++)
+            lists.brickStart[b + 1] += lists.brickStart[b];
+        
+        lists.sphereIndices.resize(lists.brickStart[brickCount]);
+        std::vector<int> cursor(lists.brickStart.begin(), lists.brickStart.end() - 1);
+        for (size_t i = 0; i < count; i++)
+            forEachBrick(i, [&](int b) { lists.sphereIndices[cursor[b]++] = static_cast<int>(i); });
+        
+        for (int b = 0; b < brickCount; b++)
+            if (lists.brickStart[b + 1] > lists.brickStart[b])
+                lists.activeBricks.push_back(b);
+    }
+    
+    void bricksInBox(const GridRegion& region, int brickCells, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                     std::vector<int>& bricks)
+    {
+        bricks.clear();
+        brickCells = std::max(brickCells, 1);
+        glm::ivec3 brickCount = glm::max((region.end - region.begin + brickCells - 1) / brickCells, glm::ivec3(0));
+        glm::vec3 regionMin = region.boundsMin();
+        if (glm::any(glm::lessThanEqual(brickCount, glm::ivec3(0))) ||
+            glm::any(glm::greaterThan(boundsMin, region.boundsMax())) || glm::any(glm::lessThan(boundsMax, regionMin)))
+            return;
+        
+        // Same brick ranges as the support boxes in buildBrickSphereLists
+        float brickSize = brickCells * region.cellSize;
+        glm::ivec3 first = glm::clamp(glm::ivec3(glm::floor((boundsMin - regionMin) / brickSize)), glm::ivec3(0), brickCount - 1);
+        glm::ivec3 last = glm::clamp(glm::ivec3(glm::floor((boundsMax - regionMin) / brickSize)), glm::ivec3(0), brickCount - 1);
+        for (int z = first.z; z <= last.z; z++)
+            for (int y = first.y; y <= last.y; y++)
+                for (int x = first.x; x <= last.x; x++)
+                    bricks.push_back((z * brickCount.y + y) * brickCount.x + x);
+    }
+    
+    void cullBricks(const GridRegion& region, int brickCells, const Frustum& frustum, const std::vector<int>& bricks,
+                    std::vector<int>& visible)
+    {
+        visible.clear();
+        brickCells = std::max(brickCells, 1);
+        glm::ivec3 brickCount = glm::max((region.end - region.begin + brickCells - 1) / brickCells, glm::ivec3(1));
+        for (int b : bricks)
+        {
+            glm::ivec3 first = region.begin + glm::ivec3(b % brickCount.x, (b / brickCount.x) % brickCount.y,
+                                                         b / (brickCount.x * brickCount.y)) * brickCells;
+            glm::ivec3 last = glm::min(first + brickCells, region.end);
+            if (frustum.intersects(region.latticePoint(first.x, first.y, first.z), region.latticePoint(last.x, last.y, last.z)))
+                visible.push_back(b);
+        }
+    }
+    
+    bool influenceBounds(const SphereSet& spheres, const FieldParams& params, float isoLevel,
+                         glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        if (spheres.size() == 0 || isoLevel <= 0.0f)
+            return false;
+        
+        glm::vec3 centreMin(std::numeric_limits<float>::max()), centreMax(-std::numeric_limits<float>::max());
+        glm::vec3 supportMin = centreMin, supportMax = centreMax;
+        float radiusSqSum = 0.0f;
+        for (size_t i = 0; i < spheres.size(); i++)
+        {
+            glm::vec3 center(spheres.x[i], spheres.y[i], spheres.z[i]);
+            float reach = spheres.radius[i] * params.supportScale;
+            centreMin = glm::min(centreMin, center);
+            centreMax = glm::max(centreMax, center);
+            supportMin = glm::min(supportMin, center - reach);
+            supportMax = glm::max(supportMax, center + reach);
+            radiusSqSum += spheres.radius[i] * spheres.radius[i];
+        }
+        
+        float margin = std::sqrt(radiusSqSum / isoLevel);
+        boundsMin = centreMin - margin;
+        boundsMax = centreMax + margin;
+        if (params.kernel == FieldKernel::Compact)
+        {
+            boundsMin = glm::max(boundsMin, supportMin);
+            boundsMax = glm::min(boundsMax, supportMax);
+        }
+        return true;
+    }
+    
+    GridRegion fitGrid(const SphereSet& spheres, const FieldParams& params, float isoLevel, GridFit fit,
+                       float gridSize, int resolution, int maxResolution)
+    {
+        GridRegion fixed = GridRegion::cube(gridSize, resolution);
+        glm::vec3 low, high;
+        if (fit == GridFit::Fixed || !influenceBounds(spheres, params, isoLevel, low, high))
+            return fixed;
+        
+        if (fit == GridFit::CellSize)
+        {
+            // Cell indices on the fixed grid's lattice, so the samples do not slide as the bounds move;
+            // shorter axes grow evenly on both sides to the cube's edge
+            glm::ivec3 first = glm::ivec3(glm::floor((low - fixed.origin) / fixed.cellSize));
+            glm::ivec3 last = glm::ivec3(glm::ceil((high - fixed.origin) / fixed.cellSize));
+            glm::ivec3 span = glm::max(last - first, glm::ivec3(1));
+            int cells = std::max(span.x, std::max(span.y, span.z));
+            if (cells <= maxResolution)
+            {
+                first -= (cells - span) / 2;
+                return { fixed.origin + glm::vec3(first) * fixed.cellSize, fixed.cellSize, glm::ivec3(0), glm::ivec3(cells) };
+            }
+            resolution = maxResolution;
+        }
+        
+        glm::vec3 extent = high - low;
+        float size = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f));
+        return { 0.5f * (low + high) - 0.5f * size, size / float(resolution), glm::ivec3(0), glm::ivec3(resolution) };
+    }
+}
+
+BrickMesher::BrickMesher(float gridSize, int resolution, int brickCells)
+{
+    MarchingCubes::GridRegion grid = MarchingCubes::GridRegion::cube(gridSize, resolution);
+    for (int z = 0; z < resolution; z += brickCells)
+        for (int y = 0; y < resolution; y += brickCells)
+            for (int x = 0; x < resolution; x += brickCells)
+            {
+                Brick brick;
+                brick.region = grid;
+                brick.region.begin = glm::ivec3(x, y, z);
+                brick.region.end = glm::min(brick.region.begin + brickCells, glm::ivec3(resolution));
+                brick.region.halo = glm::min(brick.region.begin, glm::ivec3(1));
+                bricks.push_back(brick);
+            }
+}
+
+int BrickMesher::update(const SphereSet& spheres, float isoLevel, const MarchingCubes::MeshSettings& settings,
+                        const Frustum* frustum)
+{
+    using namespace MarchingCubes;
+    
+    bool compact = settings.field.kernel == FieldKernel::Compact;
+    size_t count = spheres.size();
+    std::vector<glm::vec3> currentMin(count), currentMax(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 center(spheres.x[i], spheres.y[i], spheres.z[i]);
+        float reach = compact ? spheres.radius[i] * settings.field.supportScale : 0.0f;
+        currentMin[i] = center - reach;
+        currentMax[i] = center + reach;
+    }
+    
+    bool rebuildAll = fullRebuild || count != previousMin.size() || isoLevel != previousIsoLevel ||
+                      settings.field.kernel != previousField.kernel || settings.field.supportScale != previousField.supportScale ||
+                      settings.extractor != previousExtractor;
+    bool useHalo = settings.extractor == Extractor::SurfaceNets;
+    
+    // Old and new boxes of every sphere that moved or changed size
+    std::vector<glm::vec3> changedMin, changedMax;
+    for (size_t i = 0; i < count && !rebuildAll; i++)
+    {
+        if (currentMin[i] == previousMin[i] && currentMax[i] == previousMax[i])
+            continue;
+        if (!compact)
+        {
+            rebuildAll = true;
+            break;
+        }
+        changedMin.push_back(previousMin[i]);
+        changedMax.push_back(previousMax[i]);
+        changedMin.push_back(currentMin[i]);
+        changedMax.push_back(currentMax[i]);
+    }
+    
+    // InverseSquare spheres have no support box, but beyond the influence bounds the field stays below isoLevel
+    glm::vec3 boundsMin, boundsMax;
+    bool bounded = compact || influenceBounds(spheres, settings.field, isoLevel, boundsMin, boundsMax);
+    
+    std::vector<int> dirty, empty;
+    for (size_t b = 0; b < bricks.size(); b++)
+    {
+        bool touched = rebuildAll;
+        const GridRegion& region = bricks[b].region;
+        glm::ivec3 first = useHalo ? region.begin - region.halo : region.begin;
+        glm::vec3 brickMin = region.latticePoint(first.x, first.y, first.z);
+        glm::vec3 brickMax = region.boundsMax();
+        for (size_t r = 0; r < changedMin.size() && !touched; r++)
+            touched = glm::all(glm::lessThanEqual(changedMin[r], brickMax)) && glm::all(glm::lessThanEqual(brickMin, changedMax[r]));
+        
+        // Culled bricks keep their old mesh and catch up once they come back into view
+        bricks[b].visible = !frustum || frustum->intersects(brickMin, brickMax);
+        touched = touched || bricks[b].stale;
+        bricks[b].stale = touched && !bricks[b].visible;
+        if (!touched || bricks[b].stale)
+            continue;
+        
+        // Bricks nothing overlaps are emptied here instead of being sampled
+        bool overlapped = !bounded;
+        if (compact)
+        {
+            for (size_t i = 0; i < count && !overlapped; i++)
+                overlapped = glm::all(glm::lessThanEqual(currentMin[i], brickMax)) && glm::all(glm::lessThanEqual(brickMin, currentMax[i]));
+        }
+        else if (bounded)
+        {
+            overlapped = glm::all(glm::lessThanEqual(boundsMin, brickMax)) && glm::all(glm::lessThanEqual(brickMin, boundsMax));
+        }
+        (overlapped ? dirty : empty).push_back(static_cast<int>(b));
+    }
+    
+    for (int b : empty)
+    {
+        if (bricks[b].mesh.indices.empty() && bricks[b].mesh.vertices.empty())
+            continue;
+        bricks[b].mesh = Mesh();
+        bricks[b].version++;
+    }
+    
+    if (!dirty.empty())
+    {
+        unsigned int workers = Threading::workerCount(settings.threadCount);
+        SphereHashGrid grid;
+        if (compact)
+            grid.build(spheres, settings.field.supportScale, workers);
+        
+        // Bricks are the unit of parallelism here, so each one is meshed on a single thread
+        MeshSettings brickSettings = settings;
+        brickSettings.threadCount = 1;
+        Threading::parallelFor(static_cast<int>(dirty.size()), [&](int n) {
+            Brick& brick = bricks[dirty[n]];
+            brick.mesh = extractMesh(spheres, brick.region, isoLevel, brickSettings, compact ? &grid : nullptr);
+            brick.version++;
+        }, workers);
+    }
+    
+    previousMin = std::move(currentMin);
+    previousMax = std::move(currentMax);
+    previousIsoLevel = isoLevel;
+    previousField = settings.field;
+    previousExtractor = settings.extractor;
+    fullRebuild = false;
+    return static_cast<int>(dirty.size() + empty.size());
+}
+
+FrameProfiler::FrameProfiler() : ring(4096)
+{
+    glGenQueries(GPU_LATENCY * MAX_PHASES, &queries[0][0]);
+}
+
+FrameProfiler::~FrameProfiler()
+{
+    finish();
+    glDeleteQueries(GPU_LATENCY * MAX_PHASES, &queries[0][0]);
+}
+
+int FrameProfiler::addPhase(const std::string& name)
+{
+    if (phaseNames.size() >= MAX_PHASES)
+        return MAX_PHASES - 1;
+    phaseNames.push_back(name);
+    return static_cast<int>(phaseNames.size()) - 1;
+}
+
+int FrameProfiler::addCounter(const std::string& name)
+{
+    if (counterNames.size() >= MAX_COUNTERS)
+        return MAX_COUNTERS - 1;
+    counterNames.push_back(name);
+    return static_cast<int>(counterNames.size()) - 1;
+}
+
+void FrameProfiler::setCounter(int counter, float value)
+{
+    if (!frameOpen)
+        return;
+    pending[(frameIndex - 1) % GPU_LATENCY].counters[counter] = value;
+}
+
+bool FrameProfiler::startCsv(const std::string& path)
+{
+    csv.open(path);
+    if (!csv)
+    {
+        std::cout << "ERROR::PROFILER::CANNOT_OPEN " << path << std::endl;
+        return false;
+    }
+    
+    csv << "frame,frame_ms";
+    for (const std::string& name : phaseNames)
+        csv << ',' << name << "_cpu_ms," << name << "_gpu_ms";
+    for (const std::string& name : counterNames)
+        csv << ',' << name;
+    csv << '\n';
+    
+    recording = true;
+    writing = true;
+    writer = std::thread([this]() {
+        while (writing.load())
+        {
+            writeSamples();
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    });
+    return true;
+}
+
+void FrameProfiler::beginFrame()
+{
+    Clock::time_point now = Clock::now();
+    if (frameOpen)
+    {
+        int previous = static_cast<int>((frameIndex - 1) % GPU_LATENCY);
+        pending[previous].frameMs = std::chrono::duration<float, std::milli>(now - frameStart).count();
+    }
+    
+    // This slot's queries were issued GPU_LATENCY frames ago and are normally done by now
+    int slot = static_cast<int>(frameIndex % GPU_LATENCY);
+    resolve(slot);
+    
+    pending[slot] = FrameSample();
+    pending[slot].frame = frameIndex;
+    for (int p = 0; p < MAX_PHASES; p++)
+        pending[slot].gpuMs[p] = -1.0f;
+    pendingUsed[slot] = true;
+    frameStart = now;
+    frameOpen = true;
+    frameIndex++;
+}
+
+void FrameProfiler::beginPhase(int phase)
+{
+    if (!frameOpen)
+        return;
+    int slot = static_cast<int>((frameIndex - 1) % GPU_LATENCY);
+    glBeginQuery(GL_TIME_ELAPSED, queries[slot][phase]);
+    queryIssued[slot][phase] = true;
+    phaseStart[phase] = Clock::now();
+}
+
+void FrameProfiler::endPhase(int phase)
+{
+    if (!frameOpen)
+        return;
+    int slot = static_cast<int>((frameIndex - 1) % GPU_LATENCY);
+    pending[slot].cpuMs[phase] += std::chrono::duration<float, std::milli>(Clock::now() - phaseStart[phase]).count();
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void FrameProfiler::resolve(int slot, bool wait)
+{
+    if (!pendingUsed[slot])
+        return;
+    
+    FrameSample& sample = pending[slot];
+    for (int p = 0; p < MAX_PHASES; p++)
+    {
+        if (!queryIssued[slot][p])
+            continue;
+        queryIssued[slot][p] = false;
+        
+        // Uncapped frames can run more than GPU_LATENCY ahead of the GPU; drop the result then
+        GLuint available = GL_TRUE;
+        if (!wait)
+            glGetQueryObjectuiv(queries[slot][p], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries[slot][p], GL_QUERY_RESULT, &elapsed);
+        sample.gpuMs[p] = static_cast<float>(elapsed / 1.0e6);
+    }
+    
+    for (size_t p = 0; p < phaseNames.size(); p++)
+    {
+        cpuSum[p] += sample.cpuMs[p];
+        if (sample.gpuMs[p] >= 0.0f)
+        {
+            gpuSum[p] += sample.gpuMs[p];
+            gpuSamples[p]++;
+        }
+    }
+    for (size_t c = 0; c < counterNames.size(); c++)
+        counterSum[c] += sample.counters[c];
+    frameSum += sample.frameMs;
+    summaryFrames++;
+    
+    if (recording && !ring.push(sample))
+        droppedSamples++;
+    pendingUsed[slot] = false;
+}
+
+std::string FrameProfiler::takeSummary()
+{
+    std::ostringstream summary;
+    summary.setf(std::ios::fixed);
+    summary.precision(2);
+    if (summaryFrames > 0)
+    {
+        double meanFrame = frameSum / summaryFrames;
+        summary << "FPS: " << static_cast<int>(meanFrame > 0.0 ? 1000.0 / meanFrame : 0.0);
+        for (size_t p = 0; p < phaseNames.size(); p++)
+            summary << " | " << phaseNames[p] << " " << cpuSum[p] / summaryFrames << "/"
+                    << (gpuSamples[p] > 0 ? gpuSum[p] / gpuSamples[p] : 0.0) << " ms";
+        summary.precision(0);
+        for (size_t c = 0; c < counterNames.size(); c++)
+            summary << " | " << counterNames[c] << " " << counterSum[c] / summaryFrames;
+    }
+    
+    std::fill(std::begin(cpuSum), std::end(cpuSum), 0.0);
+    std::fill(std::begin(gpuSum), std::end(gpuSum), 0.0);
+    std::fill(std::begin(counterSum), std::end(counterSum), 0.0);
+    std::fill(std::begin(gpuSamples), std::end(gpuSamples), 0);
+    frameSum = 0.0;
+    summaryFrames = 0;
+    return summary.str();
+}
+
+void FrameProfiler::writeSamples()
+{
+    FrameSample sample;
+    while (ring.pop(sample))
+    {
+        csv << sample.frame << ',' << sample.frameMs;
+        for (size_t p = 0; p < phaseNames.size(); p++)
+            csv << ',' << sample.cpuMs[p] << ',' << sample.gpuMs[p];
+        for (size_t c = 0; c < counterNames.size(); c++)
+            csv << ',' << sample.counters[c];
+        csv << '\n';
+    }
+}
+
+void FrameProfiler::finish()
+{
+    // The frame still open has no successor, so it gets no frame time
+    for (unsigned long long f = frameIndex; f < frameIndex + GPU_LATENCY; f++)
+        resolve(static_cast<int>(f % GPU_LATENCY), true);
+    frameOpen = false;
+    
+    if (writer.joinable())
+    {
+        writing = false;
+        writer.join();
+    }
+    if (recording)
+    {
+        recording = false;
+        writeSamples();
+        if (droppedSamples > 0)
+            std::cout << "Profiler dropped " << droppedSamples << " samples (CSV writer fell behind)" << std::endl;
+        csv.close();
+    }
+}
+
+ResolutionGovernor::ResolutionGovernor(double budgetMs, int resolution, int minResolution, int maxResolution)
+    : budgetMs(budgetMs), current(std::min(std::max(resolution, minResolution), maxResolution)),
+      minResolution(minResolution), maxResolution(maxResolution)
+{
+    samples.reserve(WINDOW);
+}
+
+bool ResolutionGovernor::update(double frameMs)
+{
+    samples.push_back(frameMs);
+    if (samples.size() < static_cast<size_t>(WINDOW))
+        return false;
+    std::nth_element(samples.begin(), samples.begin() + WINDOW / 2, samples.end());
+    median = samples[WINDOW / 2];
+    samples.clear();
+    
+    // Resolution at which the cost, scaled by the cell count, would just meet the budget
+    int estimate = static_cast<int>(current * std::cbrt(budgetMs / std::max(median, 1e-3)));
+    int next = current;
+    if (median > budgetMs)
+        next = std::min(estimate, current - 1);
+    else if (median < HEADROOM * budgetMs)
+        next = current + std::min(std::max(estimate - current, 1), MAX_STEP_UP);
+    next = std::min(std::max(next, minResolution), maxResolution);
+    
+    bool changed = next != current;
+    current = next;
+    return changed;
+}
+
+namespace Threading {
+    
+    unsigned int workerCount(unsigned int requested)
+    {
+        if (requested > 0)
+            return requested;
+        unsigned int hardware = std::thread::hardware_concurrency();
+        return hardware > 0 ? hardware : 1;
+    }
+    
+    void parallelFor(int taskCount, const std::function<void(int)>& task, unsigned int threadCount)
+    {
+        if (taskCount <= 0)
+            return;
+        
+        int workers = std::min(static_cast<int>(workerCount(threadCount)), taskCount);
+        if (workers == 1)
+        {
+            for (int i = 0; i < taskCount; i++)
+                task(i);
+            return;
+        }
+        
+        // Every worker starts with a contiguous block of tasks (keeps neighbouring slabs together)
+        // and pops from its front; once empty it steals from the back of another worker's queue.
+        struct WorkQueue {
+            std::mutex mutex;
+            std::deque<int> tasks;
+        };
+        std::vector<WorkQueue> queues(workers);
+        for (int w = 0; w < workers; w++)
+        {
+            int begin = static_cast<int>(static_cast<long long>(taskCount) * w / workers);
+            int end = static_cast<int>(static_cast<long long>(taskCount) * (w + 1) / workers);
+            for (int i = begin; i < end; i++)
+                queues[w].tasks.push_back(i);
+        }
+        
+        auto worker = [&](int self) {
+            for (;;)
+            {
+                int next = -1;
+                {
+                    std::lock_guard<std::mutex> lock(queues[self].mutex);
+                    if (!queues[self].tasks.empty())
+                    {
+                        next = queues[self].tasks.front();
+                        queues[self].tasks.pop_front();
+                    }
+                }
+                
+                for (int offset = 1; next < 0 && offset < workers; offset++)
+                {
+                    WorkQueue& victim = queues[(self + offset) % workers];
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    if (!victim.tasks.empty())
+                    {
+                        next = victim.tasks.back();
+                        victim.tasks.pop_back();
+                    }
+                }
+                
+                // Tasks never enqueue new tasks, so empty queues everywhere means we are done
+                if (next < 0)
+                    return;
+                task(next);
+            }
+        };
+        
+        std::vector<std::thread> threads;
+        threads.reserve(workers - 1);
+        for (int w = 1; w < workers; w++)
+            threads.emplace_back(worker, w);
+        worker(0);
+        for (auto& thread : threads)
+            thread.join();
+    }
+}
+
+namespace MarchingCubes {
+    
+const int edgeTable[256] = {
+0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
+0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
+0x190, 0x99 , 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
+0x99c, 0x895, 0xb9f, 0xa96, 0xd9a, 0xc93, 0xf99, 0xe90,
+0x230, 0x339, 0x33 , 0x13a, 0x636, 0x73f, 0x435, 0x53c,
+0xa3c, 0xb35, 0x83f, 0x936, 0xe3a, 0xf33, 0xc39, 0xd30,
+0x3a0, 0x2a9, 0x1a3, 0xaa , 0x7a6, 0x6af, 0x5a5, 0x4ac,
+0xbac, 0xaa5, 0x9af, 0x8a6, 0xfaa, 0xea3, 0xda9, 0xca0,
+0x460, 0x569, 0x663, 0x76a, 0x66 , 0x16f, 0x265, 0x36c,
+0xc6c, 0xd65, 0xe6f, 0xf66, 0x86a, 0x963, 0xa69, 0xb60,
+0x5f0, 0x4f9, 0x7f3, 0x6fa, 0x1f6, 0xff , 0x3f5, 0x2fc,
+0xdfc, 0xcf5, 0xfff, 0xef6, 0x9fa, 0x8f3, 0xbf9, 0xaf0,
+0x650, 0x759, 0x453, 0x55a, 0x256, 0x35f, 0x55 , 0x15c,
+0xe5c, 0xf55, 0xc5f, 0xd56, 0xa5a, 0xb53, 0x859, 0x950,
+0x7c0, 0x6c9, 0x5c3, 0x4ca, 0x3c6, 0x2cf, 0x1c5, 0xcc ,
+0xfcc, 0xec5, 0xdcf, 0xcc6, 0xbca, 0xac3, 0x9c9, 0x8c0,
+0x8c0, 0x9c9, 0xac3, 0xbca, 0xcc6, 0xdcf, 0xec5, 0xfcc,
+0xcc , 0x1c5, 0x2cf, 0x3c6, 0x4ca, 0x5c3, 0x6c9, 0x7c0,
+0x950, 0x859, 0xb53, 0xa5a, 0xd56, 0xc5f, 0xf55, 0xe5c,
+0x15c, 0x55 , 0x35f, 0x256, 0x55a, 0x453, 0x759, 0x650,
+0xaf0, 0xbf9, 0x8f3, 0x9fa, 0xef6, 0xfff, 0xcf5, 0xdfc,
+0x2fc, 0x3f5, 0xff , 0x1f6, 0x6fa, 0x7f3, 0x4f9, 0x5f0,
+0xb60, 0xa69, 0x963, 0x86a, 0xf66, 0xe6f, 0xd65, 0xc6c,
+0x36c, 0x265, 0x16f, 0x66 , 0x76a, 0x663, 0x569, 0x460,
+0xca0, 0xda9, 0xea3, 0xfaa, 0x8a6, 0x9af, 0xaa5, 0xbac,
+0x4ac, 0x5a5, 0x6af, 0x7a6, 0xaa , 0x1a3, 0x2a9, 0x3a0,
+0xd30, 0xc39, 0xf33, 0xe3a, 0x936, 0x83f, 0xb35, 0xa3c,
+0x53c, 0x435, 0x73f, 0x636, 0x13a, 0x33 , 0x339, 0x230,
+0xe90, 0xf99, 0xc93, 0xd9a, 0xa96, 0xb9f, 0x895, 0x99c,
+0x69c, 0x795, 0x49f, 0x596, 0x29a, 0x393, 0x99 , 0x190,
+0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c,
+0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0   };
+const int triTable[256][16] =
+{{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 8, 3, 9, 8, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 3, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{9, 2, 10, 0, 2, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{2, 8, 3, 2, 10, 8, 10, 9, 8, -1, -1, -1, -1, -1, -1, -1},
+{3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 11, 2, 8, 11, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 9, 0, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 11, 2, 1, 9, 11, 9, 8, 11, -1, -1, -1, -1, -1, -1, -1},
+{3, 10, 1, 11, 10, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 10, 1, 0, 8, 10, 8, 11, 10, -1, -1, -1, -1, -1, -1, -1},
+{3, 9, 0, 3, 11, 9, 11, 10, 9, -1, -1, -1, -1, -1, -1, -1},
+{9, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 3, 0, 7, 3, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 1, 9, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 1, 9, 4, 7, 1, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 10, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{3, 4, 7, 3, 0, 4, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1},
+{9, 2, 10, 9, 0, 2, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
+{2, 10, 9, 2, 9, 7, 2, 7, 3, 7, 9, 4, -1, -1, -1, -1},
+{8, 4, 7, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{11, 4, 7, 11, 2, 4, 2, 0, 4, -1, -1, -1, -1, -1, -1, -1},
+{9, 0, 1, 8, 4, 7, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
+{4, 7, 11, 9, 4, 11, 9, 11, 2, 9, 2, 1, -1, -1, -1, -1},
+{3, 10, 1, 3, 11, 10, 7, 8, 4, -1, -1, -1, -1, -1, -1, -1},
+{1, 11, 10, 1, 4, 11, 1, 0, 4, 7, 11, 4, -1, -1, -1, -1},
+{4, 7, 8, 9, 0, 11, 9, 11, 10, 11, 0, 3, -1, -1, -1, -1},
+{4, 7, 11, 4, 11, 9, 9, 11, 10, -1, -1, -1, -1, -1, -1, -1},
+{9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{9, 5, 4, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 5, 4, 1, 5, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{8, 5, 4, 8, 3, 5, 3, 1, 5, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 10, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{3, 0, 8, 1, 2, 10, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
+{5, 2, 10, 5, 4, 2, 4, 0, 2, -1, -1, -1, -1, -1, -1, -1},
+{2, 10, 5, 3, 2, 5, 3, 5, 4, 3, 4, 8, -1, -1, -1, -1},
+{9, 5, 4, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 11, 2, 0, 8, 11, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
+{0, 5, 4, 0, 1, 5, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
+{2, 1, 5, 2, 5, 8, 2, 8, 11, 4, 8, 5, -1, -1, -1, -1},
+{10, 3, 11, 10, 1, 3, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1},
+{4, 9, 5, 0, 8, 1, 8, 10, 1, 8, 11, 10, -1, -1, -1, -1},
+{5, 4, 0, 5, 0, 11, 5, 11, 10, 11, 0, 3, -1, -1, -1, -1},
+{5, 4, 8, 5, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1},
+{9, 7, 8, 5, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{9, 3, 0, 9, 5, 3, 5, 7, 3, -1, -1, -1, -1, -1, -1, -1},
+{0, 7, 8, 0, 1, 7, 1, 5, 7, -1, -1, -1, -1, -1, -1, -1},
+{1, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{9, 7, 8, 9, 5, 7, 10, 1, 2, -1, -1, -1, -1, -1, -1, -1},
+{10, 1, 2, 9, 5, 0, 5, 3, 0, 5, 7, 3, -1, -1, -1, -1},
+{8, 0, 2, 8, 2, 5, 8, 5, 7, 10, 5, 2, -1, -1, -1, -1},
+{2, 10, 5, 2, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1},
+{7, 9, 5, 7, 8, 9, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1},
+{9, 5, 7, 9, 7, 2, 9, 2, 0, 2, 7, 11, -1, -1, -1, -1},
+{2, 3, 11, 0, 1, 8, 1, 7, 8, 1, 5, 7, -1, -1, -1, -1},
+{11, 2, 1, 11, 1, 7, 7, 1, 5, -1, -1, -1, -1, -1, -1, -1},
+{9, 5, 8, 8, 5, 7, 10, 1, 3, 10, 3, 11, -1, -1, -1, -1},
+{5, 7, 0, 5, 0, 9, 7, 11, 0, 1, 0, 10, 11, 10, 0, -1},
+{11, 10, 0, 11, 0, 3, 10, 5, 0, 8, 0, 7, 5, 7, 0, -1},
+{11, 10, 5, 7, 11, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 3, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{9, 0, 1, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 8, 3, 1, 9, 8, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
+{1, 6, 5, 2, 6, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 6, 5, 1, 2, 6, 3, 0, 8, -1, -1, -1, -1, -1, -1, -1},
+{9, 6, 5, 9, 0, 6, 0, 2, 6, -1, -1, -1, -1, -1, -1, -1},
+{5, 9, 8, 5, 8, 2, 5, 2, 6, 3, 2, 8, -1, -1, -1, -1},
+{2, 3, 11, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{11, 0, 8, 11, 2, 0, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
+{0, 1, 9, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
+{5, 10, 6, 1, 9, 2, 9, 11, 2, 9, 8, 11, -1, -1, -1, -1},
+{6, 3, 11, 6, 5, 3, 5, 1, 3, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 11, 0, 11, 5, 0, 5, 1, 5, 11, 6, -1, -1, -1, -1},
+{3, 11, 6, 0, 3, 6, 0, 6, 5, 0, 5, 9, -1, -1, -1, -1},
+{6, 5, 9, 6, 9, 11, 11, 9, 8, -1, -1, -1, -1, -1, -1, -1},
+{5, 10, 6, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 3, 0, 4, 7, 3, 6, 5, 10, -1, -1, -1, -1, -1, -1, -1},
+{1, 9, 0, 5, 10, 6, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
+{10, 6, 5, 1, 9, 7, 1, 7, 3, 7, 9, 4, -1, -1, -1, -1},
+{6, 1, 2, 6, 5, 1, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 5, 5, 2, 6, 3, 0, 4, 3, 4, 7, -1, -1, -1, -1},
+{8, 4, 7, 9, 0, 5, 0, 6, 5, 0, 2, 6, -1, -1, -1, -1},
+{7, 3, 9, 7, 9, 4, 3, 2, 9, 5, 9, 6, 2, 6, 9, -1},
+{3, 11, 2, 7, 8, 4, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
+{5, 10, 6, 4, 7, 2, 4, 2, 0, 2, 7, 11, -1, -1, -1, -1},
+{0, 1, 9, 4, 7, 8, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1},
+{9, 2, 1, 9, 11, 2, 9, 4, 11, 7, 11, 4, 5, 10, 6, -1},
+{8, 4, 7, 3, 11, 5, 3, 5, 1, 5, 11, 6, -1, -1, -1, -1},
+{5, 1, 11, 5, 11, 6, 1, 0, 11, 7, 11, 4, 0, 4, 11, -1},
+{0, 5, 9, 0, 6, 5, 0, 3, 6, 11, 6, 3, 8, 4, 7, -1},
+{6, 5, 9, 6, 9, 11, 4, 7, 9, 7, 11, 9, -1, -1, -1, -1},
+{10, 4, 9, 6, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 10, 6, 4, 9, 10, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1},
+{10, 0, 1, 10, 6, 0, 6, 4, 0, -1, -1, -1, -1, -1, -1, -1},
+{8, 3, 1, 8, 1, 6, 8, 6, 4, 6, 1, 10, -1, -1, -1, -1},
+{1, 4, 9, 1, 2, 4, 2, 6, 4, -1, -1, -1, -1, -1, -1, -1},
+{3, 0, 8, 1, 2, 9, 2, 4, 9, 2, 6, 4, -1, -1, -1, -1},
+{0, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{8, 3, 2, 8, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1},
+{10, 4, 9, 10, 6, 4, 11, 2, 3, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 2, 2, 8, 11, 4, 9, 10, 4, 10, 6, -1, -1, -1, -1},
+{3, 11, 2, 0, 1, 6, 0, 6, 4, 6, 1, 10, -1, -1, -1, -1},
+{6, 4, 1, 6, 1, 10, 4, 8, 1, 2, 1, 11, 8, 11, 1, -1},
+{9, 6, 4, 9, 3, 6, 9, 1, 3, 11, 6, 3, -1, -1, -1, -1},
+{8, 11, 1, 8, 1, 0, 11, 6, 1, 9, 1, 4, 6, 4, 1, -1},
+{3, 11, 6, 3, 6, 0, 0, 6, 4, -1, -1, -1, -1, -1, -1, -1},
+{6, 4, 8, 11, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{7, 10, 6, 7, 8, 10, 8, 9, 10, -1, -1, -1, -1, -1, -1, -1},
+{0, 7, 3, 0, 10, 7, 0, 9, 10, 6, 7, 10, -1, -1, -1, -1},
+{10, 6, 7, 1, 10, 7, 1, 7, 8, 1, 8, 0, -1, -1, -1, -1},
+{10, 6, 7, 10, 7, 1, 1, 7, 3, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 6, 1, 6, 8, 1, 8, 9, 8, 6, 7, -1, -1, -1, -1},
+{2, 6, 9, 2, 9, 1, 6, 7, 9, 0, 9, 3, 7, 3, 9, -1},
+{7, 8, 0, 7, 0, 6, 6, 0, 2, -1, -1, -1, -1, -1, -1, -1},
+{7, 3, 2, 6, 7, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{2, 3, 11, 10, 6, 8, 10, 8, 9, 8, 6, 7, -1, -1, -1, -1},
+{2, 0, 7, 2, 7, 11, 0, 9, 7, 6, 7, 10, 9, 10, 7, -1},
+{1, 8, 0, 1, 7, 8, 1, 10, 7, 6, 7, 10, 2, 3, 11, -1},
+{11, 2, 1, 11, 1, 7, 10, 6, 1, 6, 7, 1, -1, -1, -1, -1},
+{8, 9, 6, 8, 6, 7, 9, 1, 6, 11, 6, 3, 1, 3, 6, -1},
+{0, 9, 1, 11, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{7, 8, 0, 7, 0, 6, 3, 11, 0, 11, 6, 0, -1, -1, -1, -1},
+{7, 11, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{3, 0, 8, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 1, 9, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{8, 1, 9, 8, 3, 1, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
+{10, 1, 2, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 10, 3, 0, 8, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+{2, 9, 0, 2, 10, 9, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+{6, 11, 7, 2, 10, 3, 10, 8, 3, 10, 9, 8, -1, -1, -1, -1},
+{7, 2, 3, 6, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{7, 0, 8, 7, 6, 0, 6, 2, 0, -1, -1, -1, -1, -1, -1, -1},
+{2, 7, 6, 2, 3, 7, 0, 1, 9, -1, -1, -1, -1, -1, -1, -1},
+{1, 6, 2, 1, 8, 6, 1, 9, 8, 8, 7, 6, -1, -1, -1, -1},
+{10, 7, 6, 10, 1, 7, 1, 3, 7, -1, -1, -1, -1, -1, -1, -1},
+{10, 7, 6, 1, 7, 10, 1, 8, 7, 1, 0, 8, -1, -1, -1, -1},
+{0, 3, 7, 0, 7, 10, 0, 10, 9, 6, 10, 7, -1, -1, -1, -1},
+{7, 6, 10, 7, 10, 8, 8, 10, 9, -1, -1, -1, -1, -1, -1, -1},
+{6, 8, 4, 11, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{3, 6, 11, 3, 0, 6, 0, 4, 6, -1, -1, -1, -1, -1, -1, -1},
+{8, 6, 11, 8, 4, 6, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1},
+{9, 4, 6, 9, 6, 3, 9, 3, 1, 11, 3, 6, -1, -1, -1, -1},
+{6, 8, 4, 6, 11, 8, 2, 10, 1, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 10, 3, 0, 11, 0, 6, 11, 0, 4, 6, -1, -1, -1, -1},
+{4, 11, 8, 4, 6, 11, 0, 2, 9, 2, 10, 9, -1, -1, -1, -1},
+{10, 9, 3, 10, 3, 2, 9, 4, 3, 11, 3, 6, 4, 6, 3, -1},
+{8, 2, 3, 8, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1},
+{0, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 9, 0, 2, 3, 4, 2, 4, 6, 4, 3, 8, -1, -1, -1, -1},
+{1, 9, 4, 1, 4, 2, 2, 4, 6, -1, -1, -1, -1, -1, -1, -1},
+{8, 1, 3, 8, 6, 1, 8, 4, 6, 6, 10, 1, -1, -1, -1, -1},
+{10, 1, 0, 10, 0, 6, 6, 0, 4, -1, -1, -1, -1, -1, -1, -1},
+{4, 6, 3, 4, 3, 8, 6, 10, 3, 0, 3, 9, 10, 9, 3, -1},
+{10, 9, 4, 6, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 9, 5, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 3, 4, 9, 5, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
+{5, 0, 1, 5, 4, 0, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
+{11, 7, 6, 8, 3, 4, 3, 5, 4, 3, 1, 5, -1, -1, -1, -1},
+{9, 5, 4, 10, 1, 2, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
+{6, 11, 7, 1, 2, 10, 0, 8, 3, 4, 9, 5, -1, -1, -1, -1},
+{7, 6, 11, 5, 4, 10, 4, 2, 10, 4, 0, 2, -1, -1, -1, -1},
+{3, 4, 8, 3, 5, 4, 3, 2, 5, 10, 5, 2, 11, 7, 6, -1},
+{7, 2, 3, 7, 6, 2, 5, 4, 9, -1, -1, -1, -1, -1, -1, -1},
+{9, 5, 4, 0, 8, 6, 0, 6, 2, 6, 8, 7, -1, -1, -1, -1},
+{3, 6, 2, 3, 7, 6, 1, 5, 0, 5, 4, 0, -1, -1, -1, -1},
+{6, 2, 8, 6, 8, 7, 2, 1, 8, 4, 8, 5, 1, 5, 8, -1},
+{9, 5, 4, 10, 1, 6, 1, 7, 6, 1, 3, 7, -1, -1, -1, -1},
+{1, 6, 10, 1, 7, 6, 1, 0, 7, 8, 7, 0, 9, 5, 4, -1},
+{4, 0, 10, 4, 10, 5, 0, 3, 10, 6, 10, 7, 3, 7, 10, -1},
+{7, 6, 10, 7, 10, 8, 5, 4, 10, 4, 8, 10, -1, -1, -1, -1},
+{6, 9, 5, 6, 11, 9, 11, 8, 9, -1, -1, -1, -1, -1, -1, -1},
+{3, 6, 11, 0, 6, 3, 0, 5, 6, 0, 9, 5, -1, -1, -1, -1},
+{0, 11, 8, 0, 5, 11, 0, 1, 5, 5, 6, 11, -1, -1, -1, -1},
+{6, 11, 3, 6, 3, 5, 5, 3, 1, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 10, 9, 5, 11, 9, 11, 8, 11, 5, 6, -1, -1, -1, -1},
+{0, 11, 3, 0, 6, 11, 0, 9, 6, 5, 6, 9, 1, 2, 10, -1},
+{11, 8, 5, 11, 5, 6, 8, 0, 5, 10, 5, 2, 0, 2, 5, -1},
+{6, 11, 3, 6, 3, 5, 2, 10, 3, 10, 5, 3, -1, -1, -1, -1},
+{5, 8, 9, 5, 2, 8, 5, 6, 2, 3, 8, 2, -1, -1, -1, -1},
+{9, 5, 6, 9, 6, 0, 0, 6, 2, -1, -1, -1, -1, -1, -1, -1},
+{1, 5, 8, 1, 8, 0, 5, 6, 8, 3, 8, 2, 6, 2, 8, -1},
+{1, 5, 6, 2, 1, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 3, 6, 1, 6, 10, 3, 8, 6, 5, 6, 9, 8, 9, 6, -1},
+{10, 1, 0, 10, 0, 6, 9, 5, 0, 5, 6, 0, -1, -1, -1, -1},
+{0, 3, 8, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{10, 5, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{11, 5, 10, 7, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{11, 5, 10, 11, 7, 5, 8, 3, 0, -1, -1, -1, -1, -1, -1, -1},
+{5, 11, 7, 5, 10, 11, 1, 9, 0, -1, -1, -1, -1, -1, -1, -1},
+{10, 7, 5, 10, 11, 7, 9, 8, 1, 8, 3, 1, -1, -1, -1, -1},
+{11, 1, 2, 11, 7, 1, 7, 5, 1, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 3, 1, 2, 7, 1, 7, 5, 7, 2, 11, -1, -1, -1, -1},
+{9, 7, 5, 9, 2, 7, 9, 0, 2, 2, 11, 7, -1, -1, -1, -1},
+{7, 5, 2, 7, 2, 11, 5, 9, 2, 3, 2, 8, 9, 8, 2, -1},
+{2, 5, 10, 2, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1},
+{8, 2, 0, 8, 5, 2, 8, 7, 5, 10, 2, 5, -1, -1, -1, -1},
+{9, 0, 1, 5, 10, 3, 5, 3, 7, 3, 10, 2, -1, -1, -1, -1},
+{9, 8, 2, 9, 2, 1, 8, 7, 2, 10, 2, 5, 7, 5, 2, -1},
+{1, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 7, 0, 7, 1, 1, 7, 5, -1, -1, -1, -1, -1, -1, -1},
+{9, 0, 3, 9, 3, 5, 5, 3, 7, -1, -1, -1, -1, -1, -1, -1},
+{9, 8, 7, 5, 9, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{5, 8, 4, 5, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1},
+{5, 0, 4, 5, 11, 0, 5, 10, 11, 11, 3, 0, -1, -1, -1, -1},
+{0, 1, 9, 8, 4, 10, 8, 10, 11, 10, 4, 5, -1, -1, -1, -1},
+{10, 11, 4, 10, 4, 5, 11, 3, 4, 9, 4, 1, 3, 1, 4, -1},
+{2, 5, 1, 2, 8, 5, 2, 11, 8, 4, 5, 8, -1, -1, -1, -1},
+{0, 4, 11, 0, 11, 3, 4, 5, 11, 2, 11, 1, 5, 1, 11, -1},
+{0, 2, 5, 0, 5, 9, 2, 11, 5, 4, 5, 8, 11, 8, 5, -1},
+{9, 4, 5, 2, 11, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{2, 5, 10, 3, 5, 2, 3, 4, 5, 3, 8, 4, -1, -1, -1, -1},
+{5, 10, 2, 5, 2, 4, 4, 2, 0, -1, -1, -1, -1, -1, -1, -1},
+{3, 10, 2, 3, 5, 10, 3, 8, 5, 4, 5, 8, 0, 1, 9, -1},
+{5, 10, 2, 5, 2, 4, 1, 9, 2, 9, 4, 2, -1, -1, -1, -1},
+{8, 4, 5, 8, 5, 3, 3, 5, 1, -1, -1, -1, -1, -1, -1, -1},
+{0, 4, 5, 1, 0, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{8, 4, 5, 8, 5, 3, 9, 0, 5, 0, 3, 5, -1, -1, -1, -1},
+{9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 11, 7, 4, 9, 11, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1},
+{0, 8, 3, 4, 9, 7, 9, 11, 7, 9, 10, 11, -1, -1, -1, -1},
+{1, 10, 11, 1, 11, 4, 1, 4, 0, 7, 4, 11, -1, -1, -1, -1},
+{3, 1, 4, 3, 4, 8, 1, 10, 4, 7, 4, 11, 10, 11, 4, -1},
+{4, 11, 7, 9, 11, 4, 9, 2, 11, 9, 1, 2, -1, -1, -1, -1},
+{9, 7, 4, 9, 11, 7, 9, 1, 11, 2, 11, 1, 0, 8, 3, -1},
+{11, 7, 4, 11, 4, 2, 2, 4, 0, -1, -1, -1, -1, -1, -1, -1},
+{11, 7, 4, 11, 4, 2, 8, 3, 4, 3, 2, 4, -1, -1, -1, -1},
+{2, 9, 10, 2, 7, 9, 2, 3, 7, 7, 4, 9, -1, -1, -1, -1},
+{9, 10, 7, 9, 7, 4, 10, 2, 7, 8, 7, 0, 2, 0, 7, -1},
+{3, 7, 10, 3, 10, 2, 7, 4, 10, 1, 10, 0, 4, 0, 10, -1},
+{1, 10, 2, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 9, 1, 4, 1, 7, 7, 1, 3, -1, -1, -1, -1, -1, -1, -1},
+{4, 9, 1, 4, 1, 7, 0, 8, 1, 8, 7, 1, -1, -1, -1, -1},
+{4, 0, 3, 7, 4, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{4, 8, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{9, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{3, 0, 9, 3, 9, 11, 11, 9, 10, -1, -1, -1, -1, -1, -1, -1},
+{0, 1, 10, 0, 10, 8, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1},
+{3, 1, 10, 11, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 2, 11, 1, 11, 9, 9, 11, 8, -1, -1, -1, -1, -1, -1, -1},
+{3, 0, 9, 3, 9, 11, 1, 2, 9, 2, 11, 9, -1, -1, -1, -1},
+{0, 2, 11, 8, 0, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{3, 2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{2, 3, 8, 2, 8, 10, 10, 8, 9, -1, -1, -1, -1, -1, -1, -1},
+{9, 10, 2, 0, 9, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{2, 3, 8, 2, 8, 10, 0, 1, 8, 1, 10, 8, -1, -1, -1, -1},
+{1, 10, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{1, 3, 8, 9, 1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 9, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}};
+
+    std::vector<int> packTables()
+    {
+        std::vector<int> tables(edgeTable, edgeTable + 256);
+        tables.insert(tables.end(), &triTable[0][0], &triTable[0][0] + 256 * 16);
+        for (int cubeIndex = 0; cubeIndex < 256; cubeIndex++)
+        {
+            int count = 0;
+            while (count < 16 && triTable[cubeIndex][count] != -1)
+                count++;
+            tables.push_back(count);
+        }
+        return tables;
+    }
+}
@@ -5,6 +5,16 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
 #include <string>
+#include <functional>
+#include <new>
+#include <cstddef>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <unordered_map>
+#include <utility>
 
 // Sphere structure for metaballs
 struct Sphere {
@@ -17,6 +27,135 @@ struct Sphere {
         : position(pos), radius(r), velocity(vel), color(glm::vec3(0.3f, 0.7f, 1.0f)) {}
 };
 
+// Allocator for SIMD-aligned arrays
+template <typename T, std::size_t Alignment = 32>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+    
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+    
+    T* allocate(std::size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, std::size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+    
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Structure-of-arrays sphere storage. The field kernels read x/y/z/radiusSq, the simulation
+// step x/y/z/velocity and the GPU upload x/y/z/radiusSq, each straight from these arrays.
+class SphereSet {
+public:
+    AlignedVector<float> x, y, z;
+    AlignedVector<float> radius;
+    AlignedVector<float> radiusSq;
+    AlignedVector<float> vx, vy, vz;
+    AlignedVector<glm::vec3> color;
+    // Bumped by every method that changes positions or radii, so GPU copies can tell when they are stale;
+    // code writing the arrays directly has to bump it as well
+    unsigned int revision = 0;
+    
+    // Read-only view used by the field kernels
+    struct FieldView {
+        const float* x;
+        const float* y;
+        const float* z;
+        const float* radiusSq;
+        size_t count;
+    };
+    
+    SphereSet() = default;
+    explicit SphereSet(const std::vector<Sphere>& spheres);
+    
+    void add(const Sphere& sphere);
+    void setRadius(size_t index, float r);
+    void reserve(size_t count);
+    void clear();
+    Sphere get(size_t index) const;
+    
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    FieldView fieldView() const { return { x.data(), y.data(), z.data(), radiusSq.data(), x.size() }; }
+    
+    // x, y, z and radiusSq back to back (4 * size() floats), the SphereData layout of the shaders
+    void writeShaderData(float* out) const;
+    
+    // Euler step; a velocity component flips when the sphere leaves [-boundary, boundary]
+    void integrate(float deltaTime, float boundary);
+};
+
+// Uniform hash grid over sphere centres for finite-support field kernels. Cells are as large as the
+// biggest support radius, so everything that can reach a point sits in the 27 cells around it.
+class SphereHashGrid {
+public:
+    // Counting sort of the centres into buckets: O(N), split across threads for large sets
+    void build(const SphereSet& spheres, float supportScale, unsigned int threadCount = 0);
+    
+    // Calls visit(sphereIndex) for every sphere whose support radius reaches position
+    template <typename Visitor>
+    void forEachNear(const glm::vec3& position, Visitor&& visit) const;
+    
+    // Collects spheres whose support reaches the segment from (xMin, y, z) to (xMax, y, z)
+    void gatherRow(float xMin, float xMax, float y, float z, std::vector<int>& out) const;
+    
+    float getCellSize() const { return cellSize; }
+    
+private:
+    struct Entry {
+        int sphere;
+        int cx, cy, cz;
+        float x, y, z;
+        float supportSq;
+    };
+    
+    float cellSize = 1.0f;
+    unsigned int tableMask = 0;
+    std::vector<int> bucketStart;
+    std::vector<Entry> entries;
+    
+    int cellCoord(float value) const { return static_cast<int>(std::floor(value / cellSize)); }
+    unsigned int bucket(int cx, int cy, int cz) const
+    {
+        return ((unsigned int)cx * 73856093u ^ (unsigned int)cy * 19349663u ^ (unsigned int)cz * 83492791u) & tableMask;
+    }
+};
+
+template <typename Visitor>
+void SphereHashGrid::forEachNear(const glm::vec3& position, Visitor&& visit) const
+{
+    if (entries.empty())
+        return;
+    
+    int px = cellCoord(position.x), py = cellCoord(position.y), pz = cellCoord(position.z);
+    for (int cz = pz - 1; cz <= pz + 1; cz++)
+        for (int cy = py - 1; cy <= py + 1; cy++)
+            for (int cx = px - 1; cx <= px + 1; cx++)
+            {
+                unsigned int b = bucket(cx, cy, cz);
+                for (int e = bucketStart[b]; e < bucketStart[b + 1]; e++)
+                {
+                    // Buckets are shared by colliding cells, so check the cell as well
+                    const Entry& entry = entries[e];
+                    if (entry.cx != cx || entry.cy != cy || entry.cz != cz)
+                        continue;
+                    float dx = position.x - entry.x, dy = position.y - entry.y, dz = position.z - entry.z;
+                    if (dx * dx + dy * dy + dz * dz < entry.supportSq)
+                        visit(entry.sphere);
+                }
+            }
+}
+
+// Indexed triangle mesh produced by the CPU mesher
+struct Mesh {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<unsigned int> indices;
+};
+
 // Camera class for 3D navigation
 class Camera {
 public:
@@ -45,13 +184,33 @@ private:
     void updateCameraVectors();
 };
 
+// View frustum as six planes (a, b, c, d), ax + by + cz + d >= 0 on the inside, taken from the rows of a
+// projection * view (* model) matrix as described by Gribb and Hartmann. Boxes are in the space the
+// matrix maps from.
+struct Frustum {
+    glm::vec4 planes[6];
+    
+    explicit Frustum(const glm::mat4& viewProjection);
+    
+    // False only when the box lies wholly outside one plane, so a few boxes near the edges pass
+    bool intersects(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+};
+
 // Shader utility class
 class Shader {
 public:
     unsigned int ID;
     
     Shader(const std::string& vertexPath, const std::string& fragmentPath);
-    Shader(const std::string& vertexPath, const std::string& geometryPath, const std::string& fragmentPath);
+    // defines: "#define ..." lines inserted after the #version line of every stage.
+    // feedbackVaryings: outputs of the geometry stage recorded, interleaved, during transform feedback.
+    Shader(const std::string& vertexPath, const std::string& geometryPath, const std::string& fragmentPath,
+           const std::string& defines = "", const std::vector<const char*>& feedbackVaryings = {});
+    explicit Shader(const std::string& computePath);
+    
+    // Linked programs are saved to directory with glGetProgramBinary, named by a hash of their sources
+    // and the driver strings, and loaded from there by later launches. Empty (the default) disables it.
+    static void setBinaryCacheDirectory(const std::string& directory);
     
     void use();
     void setBool(const std::string& name, bool value) const;
@@ -59,24 +218,521 @@ public:
     void setFloat(const std::string& name, float value) const;
     void setVec3(const std::string& name, const glm::vec3& value) const;
     void setMat4(const std::string& name, const glm::mat4& mat) const;
+    void setFloatArray(const std::string& name, const float* values, int count) const;
     
 private:
+    // glGetUniformLocation is a driver-side string lookup, so each name is asked for once
+    mutable std::unordered_map<std::string, int> uniformLocations;
+    
+    static std::string binaryCacheDirectory;
+    
+    // Links ID from (shader type, source) pairs, going through the binary cache when it is enabled
+    void build(const std::vector<std::pair<unsigned int, std::string>>& stages,
+               const std::vector<const char*>& feedbackVaryings = {});
+    bool loadBinary(const std::string& path);
+    void saveBinary(const std::string& path);
+    static const char* stageName(unsigned int type);
+    int uniformLocation(const std::string& name) const;
     void checkCompileErrors(unsigned int shader, std::string type);
     std::string readFile(const std::string& filePath);
+    static std::string insertDefines(const std::string& code, const std::string& defines);
+};
+
+// CPU mirror of the std140 FrameData block that every shader declares at FRAME_UNIFORM_BINDING.
+// vec3 members take 16 bytes in std140, except where a scalar fills the last 4 (gridSize).
+const unsigned int FRAME_UNIFORM_BINDING = 0;
+// Shader storage bindings of marching_cubes.geom: sphere arrays and the per-brick sphere lists
+const unsigned int SPHERE_STORAGE_BINDING = 1;
+const unsigned int BRICK_LIST_STORAGE_BINDING = 2;
+const unsigned int BRICK_INDEX_STORAGE_BINDING = 3;
+// Marching cubes tables (MarchingCubes::packTables), read by marching_cubes.geom and the compute mesher
+const unsigned int TABLE_STORAGE_BINDING = 4;
+// Origin cells of the bricks marching_cubes.vert walks, one instance per brick
+const unsigned int ACTIVE_BRICK_STORAGE_BINDING = 10;
+
+struct FrameUniforms {
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 lightPos;
+    float padding0;
+    glm::vec3 lightColor;
+    float padding1;
+    glm::vec3 viewPos;
+    float gridSize;
+    int gridResolution;
+    float isoLevel;
+    int numSpheres;
+    float supportScale;  // 0: InverseSquare kernel, otherwise Compact with R = supportScale * r
+    glm::vec3 gridOrigin;  // lattice point (0, 0, 0) of the shader grid
+    float padding2;
+};
+static_assert(sizeof(FrameUniforms) == 272, "FrameUniforms must match the std140 FrameData layout");
+
+// Uniform buffer object of a fixed size, bound to one binding point for its whole life
+class UniformBuffer {
+public:
+    unsigned int ID;
+    
+    UniformBuffer(size_t size, unsigned int binding);
+    ~UniformBuffer();
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+    
+    void update(const void* data, size_t size);
+};
+
+// Shader storage buffer bound to one binding point; its store grows to whatever reserve() asks for
+class StorageBuffer {
+public:
+    unsigned int ID;
+    size_t capacity;
+    
+    explicit StorageBuffer(unsigned int binding);
+    ~StorageBuffer();
+    StorageBuffer(const StorageBuffer&) = delete;
+    StorageBuffer& operator=(const StorageBuffer&) = delete;
+    
+    // Reallocates (dropping the contents) when size does not fit
+    void reserve(size_t size);
+    void write(size_t offset, const void* data, size_t size);
+};
+
+// GPU copy of a Mesh: positions, normals and indices go to separate buffers straight from its vectors
+class MeshBuffer {
+public:
+    unsigned int VAO, positionVBO, normalVBO, EBO;
+    int indexCount;
+    
+    MeshBuffer();
+    ~MeshBuffer();
+    MeshBuffer(const MeshBuffer&) = delete;
+    MeshBuffer& operator=(const MeshBuffer&) = delete;
+    
+    void upload(const Mesh& mesh);
+    void draw() const;
+};
+
+// Shader storage buffer for data rewritten every frame. The store is split into SLOTS regions written in
+// turn; a fence after the frame's last reader keeps the CPU off a region until the GPU is done with it.
+// With glBufferStorage (GL 4.4 or ARB_buffer_storage, see hasBufferStorage) the store is mapped once,
+// persistent and coherent, and callers write straight into it; otherwise writes go through a CPU copy
+// and glBufferSubData.
+class StreamingStorageBuffer {
+public:
+    static const int SLOTS = 3;
+    
+    explicit StreamingStorageBuffer(unsigned int binding);
+    ~StreamingStorageBuffer();
+    StreamingStorageBuffer(const StreamingStorageBuffer&) = delete;
+    StreamingStorageBuffer& operator=(const StreamingStorageBuffer&) = delete;
+    
+    // Moves to the next region, waiting for its fence, and returns size writable bytes
+    void* beginWrite(size_t size);
+    // Binds the region just written to the binding point
+    void endWrite();
+    // Call once the frame's draws that read the region have been issued
+    void fence();
+    
+    bool isPersistent() const { return persistent; }
+    
+private:
+    unsigned int ID = 0;
+    unsigned int binding;
+    bool persistent;
+    size_t offsetAlignment = 1;
+    size_t slotSize = 0;
+    size_t writeSize = 0;
+    int slot = 0;
+    bool written = false;
+    char* mapped = nullptr;
+    std::vector<char> staging;
+    void* fences[SLOTS] = {};  // GLsync
+    
+    void allocate(size_t size);
+    void release();
+    void waitFence(int index);
+};
+
+// Geometry-shader triangles (FragPos and Normal, interleaved) captured with transform feedback and drawn
+// again through mesh.vert. The vertex count stays with the feedback object, so drawing needs no readback.
+// The capture is already in world space (model applied), so replay with mesh.vert's worldSpaceInput set.
+class FeedbackMesh {
+public:
+    unsigned int feedback, buffer, VAO;
+    
+    explicit FeedbackMesh(size_t maxVertices);
+    ~FeedbackMesh();
+    FeedbackMesh(const FeedbackMesh&) = delete;
+    FeedbackMesh& operator=(const FeedbackMesh&) = delete;
+    
+    // Draw calls between begin() and end() are rendered and recorded, replacing the previous capture
+    void begin();
+    void end();
+    void draw() const;
+};
+
+// One texel per lattice point of a shader grid of up to maxResolution^3 cells, filled by shaders/field_volume.comp:
+// the field value (R32F) and the normalised gradient (RGBA16F, linearly filtered for vertex normals).
+// The compute pass writes them as images 0 and 1; the geometry shader reads them from texture units 0 and 1.
+const unsigned int FIELD_VOLUME_LOCAL_SIZE = 4;  // local_size_x/y/z of field_volume.comp
+
+class FieldVolume {
+public:
+    unsigned int fieldTexture, normalTexture;
+    int size;
+    
+    explicit FieldVolume(int maxResolution);
+    ~FieldVolume();
+    FieldVolume(const FieldVolume&) = delete;
+    FieldVolume& operator=(const FieldVolume&) = delete;
+    
+    // Runs the bound compute program over the (resolution + 1)^3 texels of this frame's grid and makes
+    // the result visible to texture fetches
+    void compute(int resolution);
+};
+
+// Marching cubes in compute shaders over a FieldVolume (shaders/mc_*.comp): classify each cell's vertex
+// count, prefix-sum the counts in blocks of 512 cells, then let only cells with triangles write them at
+// their offset. The total goes straight into a DrawArraysIndirectCommand, so nothing is read back and
+// empty cells cost no geometry-shader invocation. Storage bindings 5-9 belong to these passes; the tables
+// are expected at TABLE_STORAGE_BINDING.
+class ComputeMesher {
+public:
+    // Buffers are sized for grids of up to maxResolution^3 cells
+    explicit ComputeMesher(int maxResolution);
+    ~ComputeMesher();
+    ComputeMesher(const ComputeMesher&) = delete;
+    ComputeMesher& operator=(const ComputeMesher&) = delete;
+    
+    // Needs the field volume of this frame bound (FieldVolume::compute) and the FrameData block current;
+    // resolution is its gridResolution
+    void extract(int resolution);
+    // Position (location 0) and normal (location 1) per vertex, as mesh.vert expects
+    void draw() const;
+    
+private:
+    Shader classifyShader, scanShader, scanBlocksShader, generateShader;
+    StorageBuffer cellCounts, cellOffsets, blockSums, vertices, command;
+    unsigned int VAO;
 };
 
 // Marching Cubes utility functions
 namespace MarchingCubes {
-    // Grid generation
+    // Grid generation: the resolution^3 cell origins, x slowest and z fastest. The geometry shader path
+    // derives the same points from gl_VertexID (marching_cubes.vert); this is for CPU consumers.
     std::vector<glm::vec3> generateGridPoints(float gridSize, int resolution);
     
-    // Scalar field calculation
+    // Per-sphere falloff of the field
+    enum class FieldKernel {
+        InverseSquare,  // r^2 / d^2 everywhere (the shader's field)
+        Compact         // r^2 / d^2 * (1 - d^2 / R^2)^2 inside R = supportScale * r, zero outside
+    };
+    
+    struct FieldParams {
+        FieldKernel kernel = FieldKernel::InverseSquare;
+        float supportScale = 3.0f;
+    };
+    
+    // Scalar field calculation (grid, if given, limits Compact sums to nearby spheres)
     float calculateScalarField(const glm::vec3& position, const std::vector<Sphere>& spheres);
+    float calculateScalarField(const glm::vec3& position, const SphereSet& spheres,
+                               const FieldParams& params = FieldParams(), const SphereHashGrid* grid = nullptr);
+    
+    // Batched scalar field: values[n] = field at (xs[n], ys[n], zs[n]), evaluated FIELD_BATCH_SIZE points
+    // at a time with SSE/AVX lanes. Matches calculateScalarField to a relative error below 1e-6.
+    const int FIELD_BATCH_SIZE = 8;
+    void calculateScalarFieldBatch(const float* xs, const float* ys, const float* zs, float* values, size_t count,
+                                   const SphereSet& spheres, const FieldParams& params = FieldParams());
     
     // Utility functions
     glm::vec3 calculateGradient(const glm::vec3& position, const std::vector<Sphere>& spheres, float epsilon = 0.01f);
+    glm::vec3 calculateGradient(const glm::vec3& position, const SphereSet& spheres, float epsilon = 0.01f);
+    glm::vec3 calculateGradient(const glm::vec3& position, const SphereSet& spheres, const FieldParams& params,
+                                const SphereHashGrid* grid = nullptr, float epsilon = 0.01f);
+    
+    // Field value (w) and its closed-form gradient (xyz) in one pass over the spheres
+    glm::vec4 calculateFieldAndGradient(const glm::vec3& position, const SphereSet& spheres,
+                                        const FieldParams& params = FieldParams(), const SphereHashGrid* grid = nullptr);
+    
+    // Normalised analytic gradient; same direction as calculateGradient without the six extra field sums
+    glm::vec3 calculateAnalyticGradient(const glm::vec3& position, const SphereSet& spheres,
+                                        const FieldParams& params = FieldParams(), const SphereHashGrid* grid = nullptr);
+    
+    // Lookup tables (same as in shaders/marching_cubes.geom)
+    extern const int edgeTable[256];
+    extern const int triTable[256][16];
+    // The MarchingCubesTables storage block of the shaders: edgeTable, triTable row by row, then the
+    // number of used triTable entries of each cube index
+    std::vector<int> packTables();
+    
+    // MarchingCubes: a vertex per crossed edge, up to 5 triangles per cell (matches the geometry shader).
+    // SurfaceNets: a vertex per crossed cell, one quad per crossed edge. On the same lattice that gives about
+    // as many triangles as marching cubes (not half), but far fewer slivers. It needs every cell around an
+    // edge, so it runs on one thread and closes a region's lower faces only through GridRegion::halo.
+    enum class Extractor {
+        MarchingCubes,
+        SurfaceNets
+    };
+    
+    struct MeshSettings {
+        FieldParams field;
+        Extractor extractor = Extractor::MarchingCubes;
+        unsigned int threadCount = 0;  // 0 = all cores; the mesh is the same for any count
+        bool skipEmptySpace = true;    // octree field bounds drop cells that cannot contain the surface
+    };
+    
+    // Cells [begin, end) of the lattice whose point (i, j, k) sits at origin + (i, j, k) * cellSize
+    struct GridRegion {
+        glm::vec3 origin;
+        float cellSize;
+        glm::ivec3 begin;
+        glm::ivec3 end;
+        glm::ivec3 halo = glm::ivec3(0);  // surface nets: cells below begin sampled only to close its lower faces
+        
+        // The generateGridPoints lattice: resolution^3 cells centred on the origin
+        static GridRegion cube(float gridSize, int resolution);
+        
+        glm::vec3 latticePoint(int i, int j, int k) const { return origin + glm::vec3(i, j, k) * cellSize; }
+        glm::vec3 boundsMin() const { return latticePoint(begin.x, begin.y, begin.z); }
+        glm::vec3 boundsMax() const { return latticePoint(end.x, end.y, end.z); }
+    };
+    
+    // CPU isosurface extraction over the generateGridPoints lattice. The mesh is welded: each lattice
+    // edge crossing the surface gets exactly one vertex, shared by all triangles that use it.
+    Mesh extractMesh(const SphereSet& spheres, float gridSize, int resolution, float isoLevel,
+                     const MeshSettings& settings = MeshSettings());
+    // grid: prebuilt hash for the Compact kernel (built on the fly when null)
+    Mesh extractMesh(const SphereSet& spheres, const GridRegion& region, float isoLevel,
+                     const MeshSettings& settings = MeshSettings(), const SphereHashGrid* grid = nullptr);
+    
+    // The region cut into bricks of brickCells^3 cells, each listing the spheres whose field reaches it
+    // (every sphere for InverseSquare). Brick (x, y, z) is number (z * bricks.y + y) * bricks.x + x and
+    // its spheres are sphereIndices[brickStart[b] .. brickStart[b + 1]).
+    struct BrickSphereLists {
+        glm::ivec3 bricks = glm::ivec3(0);
+        int brickCells = 1;
+        std::vector<int> brickStart;
+        std::vector<int> sphereIndices;
+        std::vector<int> activeBricks;  // bricks with at least one sphere, ascending
+    };
+    
+    void buildBrickSphereLists(const SphereSet& spheres, const GridRegion& region, int brickCells,
+                               const FieldParams& params, BrickSphereLists& lists);
+    
+    // Bricks of the region (numbered as in BrickSphereLists) whose box overlaps [boundsMin, boundsMax].
+    // With the influenceBounds box these are the InverseSquare bricks that can hold surface.
+    void bricksInBox(const GridRegion& region, int brickCells, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                     std::vector<int>& bricks);
+    
+    // The bricks whose box (clipped to the region) intersects the frustum, in their original order
+    void cullBricks(const GridRegion& region, int brickCells, const Frustum& frustum, const std::vector<int>& bricks,
+                    std::vector<int>& visible);
+    
+    // Box holding every point where the field can reach isoLevel (false for no spheres or isoLevel <= 0).
+    // More than m = sqrt(sum r^2 / isoLevel) past the box of sphere centres on any axis, every centre is
+    // farther than m and the field stays below isoLevel; Compact fields also end at the support boxes.
+    bool influenceBounds(const SphereSet& spheres, const FieldParams& params, float isoLevel,
+                         glm::vec3& boundsMin, glm::vec3& boundsMax);
+    
+    // How the shader grid follows the influence bounds
+    enum class GridFit {
+        Fixed,      // GridRegion::cube(gridSize, resolution) whatever the spheres do
+        CellSize,   // cells of the fixed grid's size and lattice, as many per axis as cover the bounds
+        CellCount   // resolution cells per axis stretched over the bounds
+    };
+    
+    // Cube of cells starting at index 0 around the influence bounds. CellSize falls back to stretching
+    // maxResolution cells when the bounds need more; without bounds the fixed cube is returned.
+    GridRegion fitGrid(const SphereSet& spheres, const FieldParams& params, float isoLevel, GridFit fit,
+                       float gridSize, int resolution, int maxResolution);
+}
+
+// The grid split into fixed-size bricks of cells, each with its own cached mesh. update() compares every
+// sphere's influence box with the one from the previous call and re-meshes only the bricks that touch the
+// old or the new box. InverseSquare spheres reach every brick, so there any movement re-meshes everything.
+// A brick that no sphere's support box (Compact) or the influenceBounds box (InverseSquare) overlaps
+// gets an empty mesh without being sampled. Given a frustum, bricks outside it are not re-meshed: they
+// stay stale until an update finds them visible again.
+class BrickMesher {
+public:
+    struct Brick {
+        MarchingCubes::GridRegion region;  // halo of one cell towards lower neighbours
+        Mesh mesh;
+        unsigned int version = 0;  // bumped on every re-mesh, for re-uploading
+        bool visible = true;       // inside the frustum of the last update
+        bool stale = false;        // re-mesh put off while the brick was culled
+    };
+    
+    BrickMesher(float gridSize, int resolution, int brickCells = 16);
+    
+    // Returns the number of bricks re-meshed
+    int update(const SphereSet& spheres, float isoLevel, const MarchingCubes::MeshSettings& settings,
+               const Frustum* frustum = nullptr);
+    void invalidate() { fullRebuild = true; }
+    
+    const std::vector<Brick>& getBricks() const { return bricks; }
+    
+private:
+    std::vector<Brick> bricks;
+    std::vector<glm::vec3> previousMin, previousMax;
+    float previousIsoLevel = 0.0f;
+    MarchingCubes::FieldParams previousField;
+    MarchingCubes::Extractor previousExtractor = MarchingCubes::Extractor::MarchingCubes;
+    bool fullRebuild = true;
+};
+
+// Thread helpers for the CPU mesher
+namespace Threading {
+    unsigned int workerCount(unsigned int requested = 0);
+    
+    // Runs task(0..taskCount-1) on worker threads; idle workers steal tasks from busy ones
+    void parallelFor(int taskCount, const std::function<void(int)>& task, unsigned int threadCount = 0);
 }
 
+// Lock-free ring for exactly one producer thread and one consumer thread
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : items(capacity + 1) {}
+    
+    // False when full; the caller decides whether to drop
+    bool push(const T& value)
+    {
+        size_t write = writeIndex.load(std::memory_order_relaxed);
+        size_t next = (write + 1) % items.size();
+        if (next == readIndex.load(std::memory_order_acquire))
+            return false;
+        items[write] = value;
+        writeIndex.store(next, std::memory_order_release);
+        return true;
+    }
+    
+    bool pop(T& value)
+    {
+        size_t read = readIndex.load(std::memory_order_relaxed);
+        if (read == writeIndex.load(std::memory_order_acquire))
+            return false;
+        value = items[read];
+        readIndex.store((read + 1) % items.size(), std::memory_order_release);
+        return true;
+    }
+    
+private:
+    std::vector<T> items;
+    std::atomic<size_t> writeIndex{ 0 };
+    std::atomic<size_t> readIndex{ 0 };
+};
+
+// Per-phase CPU and GPU (GL_TIME_ELAPSED) times for every frame. GPU results are read GPU_LATENCY frames
+// later, and only once GL_QUERY_RESULT_AVAILABLE reports them, so the render thread never waits on a
+// query: a result still pending then is recorded as -1, and only finish() blocks. Finished frames go
+// through an SpscRing to a writer thread that appends them to a CSV file. Needs a current GL context
+// from construction to destruction.
+class FrameProfiler {
+public:
+    static const int MAX_PHASES = 8;
+    static const int MAX_COUNTERS = 4;
+    static const int GPU_LATENCY = 4;
+    
+    struct FrameSample {
+        unsigned long long frame = 0;
+        float frameMs = 0.0f;  // from this frame's beginFrame to the next one
+        float cpuMs[MAX_PHASES] = {};
+        float gpuMs[MAX_PHASES] = {};
+        float counters[MAX_COUNTERS] = {};
+    };
+    
+    // Times CPU and GPU work between construction and destruction. GL_TIME_ELAPSED queries cannot nest,
+    // so scopes must not overlap, and each phase gets one scope per frame (its query is reused).
+    class Scope {
+    public:
+        Scope(FrameProfiler& profiler, int phase) : profiler(profiler), phase(phase) { profiler.beginPhase(phase); }
+        ~Scope() { profiler.endPhase(phase); }
+    private:
+        FrameProfiler& profiler;
+        int phase;
+    };
+    
+    FrameProfiler();
+    ~FrameProfiler();
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+    
+    // Register all phases and counters before startCsv
+    int addPhase(const std::string& name);
+    // Per-frame value (such as a count of bricks) written beside the phase times; 0 unless set
+    int addCounter(const std::string& name);
+    void setCounter(int counter, float value);
+    bool startCsv(const std::string& path);
+    
+    void beginFrame();
+    void beginPhase(int phase);
+    void endPhase(int phase);
+    
+    // Frames per second, mean CPU/GPU ms per phase and mean counters since the previous call
+    std::string takeSummary();
+    
+    // Waits for outstanding queries, writes everything left and stops the writer thread
+    void finish();
+    
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    std::vector<std::string> phaseNames;
+    std::vector<std::string> counterNames;
+    unsigned int queries[GPU_LATENCY][MAX_PHASES];
+    bool queryIssued[GPU_LATENCY][MAX_PHASES] = {};
+    FrameSample pending[GPU_LATENCY];
+    bool pendingUsed[GPU_LATENCY] = {};
+    Clock::time_point phaseStart[MAX_PHASES];
+    Clock::time_point frameStart;
+    unsigned long long frameIndex = 0;
+    bool frameOpen = false;
+    
+    // Running sums for takeSummary
+    double cpuSum[MAX_PHASES] = {}, gpuSum[MAX_PHASES] = {}, counterSum[MAX_COUNTERS] = {}, frameSum = 0.0;
+    int summaryFrames = 0;
+    int gpuSamples[MAX_PHASES] = {};  // frames whose GPU time was ready, per phase
+    
+    SpscRing<FrameSample> ring;
+    std::thread writer;
+    std::atomic<bool> writing{ false };
+    std::ofstream csv;
+    bool recording = false;  // render-thread copy of csv.is_open(); the writer thread owns csv
+    unsigned long long droppedSamples = 0;
+    
+    // wait: block for pending results (finish) instead of recording them as -1
+    void resolve(int slot, bool wait = false);
+    void writeSamples();
+};
+
+// Picks the shader grid resolution that keeps frame times within a budget. Each decision takes the median
+// of WINDOW frames rendered at the current resolution. Above the budget the resolution drops by the cube
+// root of the overshoot (the cost follows the cell count); below HEADROOM * budget it rises towards the
+// same estimate by at most MAX_STEP_UP. The gap between the two thresholds is the hysteresis that keeps
+// it from flipping between neighbouring resolutions.
+class ResolutionGovernor {
+public:
+    static constexpr int WINDOW = 15;
+    static constexpr int MAX_STEP_UP = 2;
+    static constexpr double HEADROOM = 0.7;
+    
+    ResolutionGovernor(double budgetMs, int resolution, int minResolution, int maxResolution);
+    
+    // Records one frame rendered at resolution(); true when the resolution changed
+    bool update(double frameMs);
+    int resolution() const { return current; }
+    // Median frame time behind the latest decision (0 before the first one)
+    double medianMs() const { return median; }
+    
+private:
+    double budgetMs;
+    int current, minResolution, maxResolution;
+    std::vector<double> samples;
+    double median = 0.0;
+};
+
 // Math constants
 namespace Constants {
     const float PI = 3.14159265359f;